@@ -0,0 +1,64 @@
+#include "aot.h"
+
+#include <iostream>
+#include <vector>
+
+namespace aot {
+
+Value CompiledBody::eval(Environment* env) {
+    // Bodies run through CallNode::run, which takes tail calls itself
+    TailCall tail;
+    Value result = code(env, tail);
+    return tail.fun ? CallNode::run(tail.fun, tail.frame) : result;
+}
+
+FunNode* function(Body code, size_t params, const char* name) {
+    // Only the number of parameters is looked at once the program runs
+    FunNode* fun = new FunNode(std::vector<Symbol>(params, Symbol(0)), new CompiledBody(code));
+    fun->name = name;
+    return fun;
+}
+
+void capture(FunNode* fun, Symbol name, int depth, int slot) {
+    VariableNode* var = new VariableNode(name);
+    var->depth = depth;
+    var->slot = slot;
+    fun->captures.push_back(var);
+}
+
+Environment* enter(Value callee, size_t args, FunNode*& fun) {
+    checkFunction(callee);
+    FuncData* fData = callee.func();
+    fun = fData->fun;
+    if (args != fun->params.size()) arityError(fun->params.size(), args);
+    if (stackExhausted()) recursionError();
+
+    Environment* frame = fun->frameEscapes
+        ? runtime->heap.newFrame(fData->env, fun->frameSize)
+        : runtime->frames.push(fData->env, fun->frameSize);
+    runtime->heap.pushRoot(frame);
+    return frame;
+}
+
+int run(int globalCount, void (*program)(Environment* globals)) {
+    // Static, as in main.cpp
+    static Runtime own(std::cout, std::cerr);
+    runtime = &own;
+    limitStack(threadStackSize());
+    try {
+        Environment* globals = runtime->heap.newFrame(nullptr, globalCount);
+        runtime->heap.pushRoot(globals);
+        program(globals);
+        runtime->heap.popRoot();
+    } catch (const ProgramError& e) {
+        runtime->report(e);
+        return e.status;
+    } catch (...) {
+        runtime->out.flush();
+        throw;
+    }
+    runtime->out.flush();
+    return 0;
+}
+
+} // namespace aot
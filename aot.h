@@ -0,0 +1,64 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <cstddef>
+#include "ast.h"
+#include "heap.h"
+#include "number.h"
+#include "runtime.h"
+
+// Support for the C++ programs --emit-cpp writes (see codegen.h), which are
+// linked against the smli library. A generated program keeps the runtime
+// of the interpreter: values, frames, closures, the collector, bignums and
+// the error helpers are the ones the tree walker uses, so its output and
+// its errors are the same. Only the evaluation of the AST is compiled.
+//
+// Every function of the program is still a FunNode, made at startup, whose
+// body is the compiled code (CompiledBody). Closures are made by
+// FunNode::eval, with the captures (VariableNodes) the resolver worked out,
+// and calls run through CallNode::run, so tail calls take over the frame
+// as they do in the interpreter.
+namespace aot {
+
+// A compiled function body; `tail` works as in Node::evalTail
+typedef Value (*Body)(Environment* env, TailCall& tail);
+
+struct CompiledBody : Node {
+    Body code;
+    explicit CompiledBody(Body c) : code(c) {}
+    Value eval(Environment* env) override;
+    Value evalTail(Environment* env, TailCall& tail) override { return code(env, tail); }
+};
+
+// A function of `params` parameters with a compiled body, for the startup
+// code to fill in the rest of what the resolver decided
+FunNode* function(Body code, size_t params, const char* name);
+
+// Add a capture reading (depth, slot) where the closure is made
+void capture(FunNode* fun, Symbol name, int depth, int slot);
+
+// VariableNode::eval
+inline Value load(Environment* env, int depth, int slot, Symbol name) {
+    const Value& v = env->ancestor(depth)->slots[slot];
+    if (v.isNone()) undefinedError(name);
+    return v;
+}
+
+// DefineNode::eval
+inline void define(Environment* env, int slot, Value v, Symbol name) {
+    if (!env->slots[slot].isNone()) redefineError(name);
+    env->slots[slot] = v;
+}
+
+// The uncached part of CallNode::enter, up to the arguments: check the
+// callee and push the frame of the call, whose first `args` slots the
+// caller fills
+Environment* enter(Value callee, size_t args, FunNode*& fun);
+
+// Run a program on the runtime of the process and report its error, as
+// main.cpp does; returns the exit status
+int run(int globalCount, void (*program)(Environment* globals));
+
+} // namespace aot
+
+#endif
@@ -1,15 +1,20 @@
 #ifndef AST_H
 #define AST_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <functional>
+#include <new>
+#include "symbols.h"
 
 // Forward declarations
 struct Node;
+struct FunNode;
+struct Bignum;
 class Environment;
 
 // Types of values our language supports
@@ -20,64 +25,173 @@ enum class ValType {
     NONE // For definitions or statements that don't return a value
 };
 
-// A value in the interpreter
+// Operators handled by BinaryOpNode, decided once by the parser
+enum class OpCode {
+    ADD,     // +
+    SUB,     // -
+    MUL,     // *
+    DIV,     // /
+    MOD,     // mod
+    GREATER, // >
+    SMALLER, // <
+    EQUAL,   // =
+    AND,     // and
+    OR,      // or
+    NOT      // not
+};
+
+// A value in the interpreter, packed into one tagged 64-bit word:
+//
+//   pointer            000   FUNCTION  (FuncData*, 8-byte aligned)
+//   0                  000   NONE
+//   61-bit number <<3 | 001  NUMBER    (a fixnum)
+//   pointer          | 011   NUMBER    (Bignum*, see number.h)
+//   bool          <<3 | 010  BOOLEAN
+//
+// so a type check is a mask and compare, and a slot or argument is 8 bytes.
+// For functions (closures), the FuncData holds the function definition and its environment.
 struct Value {
-    ValType type;
-    int numVal = 0;
-    bool boolVal = false;
-    // For functions (closures), we need to store the function definition and its environment.
-    // We'll handle this with a pointer to the AST node and the environment.
-    struct FuncData* funcVal = nullptr;
+    static const uint64_t TAG_MASK = 7;
+    static const uint64_t NUMBER_TAG = 1;
+    static const uint64_t BOOLEAN_TAG = 2;
+    static const uint64_t BIGNUM_TAG = 3;
+    static const int64_t FIXNUM_MIN = -(int64_t(1) << 60);
+    static const int64_t FIXNUM_MAX = (int64_t(1) << 60) - 1;
+
+    uint64_t bits;
+
+    Value() : bits(0) {}
+    Value(int v) : bits((uint64_t(int64_t(v)) << 3) | NUMBER_TAG) {}
+    Value(bool v) : bits((uint64_t(v) << 3) | BOOLEAN_TAG) {}
+    Value(struct FuncData* f) : bits(reinterpret_cast<uintptr_t>(f)) {}
+    explicit Value(Bignum* b) : bits(reinterpret_cast<uintptr_t>(b) | BIGNUM_TAG) {}
+
+    // A number in [FIXNUM_MIN, FIXNUM_MAX]
+    static Value fixnum(int64_t v) {
+        Value result;
+        result.bits = (uint64_t(v) << 3) | NUMBER_TAG;
+        return result;
+    }
+
+    bool isNone() const { return bits == 0; }
+    // Both number tags have bit 0 set and bit 2 clear
+    bool isNumber() const { return (bits & 5) == NUMBER_TAG; }
+    bool isFixnum() const { return (bits & TAG_MASK) == NUMBER_TAG; }
+    bool isBignum() const { return (bits & TAG_MASK) == BIGNUM_TAG; }
+    bool isBool() const { return (bits & TAG_MASK) == BOOLEAN_TAG; }
+    bool isFunction() const { return (bits & TAG_MASK) == 0 && bits != 0; }
+
+    ValType type() const {
+        switch (bits & TAG_MASK) {
+        case NUMBER_TAG:
+        case BIGNUM_TAG: return ValType::NUMBER;
+        case BOOLEAN_TAG: return ValType::BOOLEAN;
+        default: return bits ? ValType::FUNCTION : ValType::NONE;
+        }
+    }
+
+    // Payload accessors; only meaningful after the matching check
+    int64_t num() const { return int64_t(bits) >> 3; } // Of a fixnum
+    Bignum* bignum() const { return reinterpret_cast<Bignum*>(uintptr_t(bits & ~TAG_MASK)); }
+    bool boolean() const { return (bits >> 3) != 0; }
+    struct FuncData* func() const { return reinterpret_cast<struct FuncData*>(uintptr_t(bits)); }
+};
+
+// Run-time checks and errors shared by the tree walker and the VM
+// (defined in interpreter.cpp). The error helpers do not return; they
+// throw a ProgramError (see runtime.h), which costs nothing until thrown.
+[[noreturn]] void typeError(const std::string& expect, const std::string& got);
+[[noreturn]] void numberTypeError(const Value& v);
+[[noreturn]] void boolTypeError(const Value& v);
+void checkFunction(const Value& v);
+[[noreturn]] void undefinedError(Symbol name);
+[[noreturn]] void redefineError(Symbol name);
+[[noreturn]] void divisionByZeroError();
+[[noreturn]] void arityError(size_t expected, size_t got);
+[[noreturn]] void recursionError();
+
+// --strict keeps the original evaluate-all-then-check order of operators
+extern bool strictEval;
+
+inline void checkNumber(const Value& v) {
+    if (!v.isNumber()) numberTypeError(v);
+}
+
+inline void checkBool(const Value& v) {
+    if (!v.isBool()) boolTypeError(v);
+}
+
+// Check the evaluated operands of `op` in order and compute the result, as
+// --strict does; also used by programs from --emit-cpp (aot.h)
+Value combineOperands(OpCode op, const Value* values, size_t count);
 
-    Value() : type(ValType::NONE) {}
-    Value(int v) : type(ValType::NUMBER), numVal(v) {}
-    Value(bool v) : type(ValType::BOOLEAN), boolVal(v) {}
+// A call in tail position that the enclosing CallNode::eval still has to
+// run: its frame is already built and holds the evaluated arguments.
+struct TailCall {
+    FunNode* fun = nullptr;
+    Environment* frame = nullptr;
 };
 
 // Abstract Syntax Tree Node Base
 struct Node {
     virtual ~Node() = default;
     virtual Value eval(Environment* env) = 0;
+    // Evaluate in tail position of a function body. A node that ends in a
+    // call may hand the call back through `tail` instead of making it, so
+    // the caller's loop runs it without growing the C++ stack.
+    virtual Value evalTail(Environment* env, TailCall& tail) { return eval(env); }
 };
 
-// Environment for variable bindings
+// Environment for variable bindings.
+// Variables are resolved to (depth, slot) before evaluation (see resolver.h),
+// so a frame is just a flat array of slots plus the enclosing frame. The
+// slots are stored right behind the header in the same block; frames are
+// created through heap.h, either on the frame arena or on the heap.
 class Environment {
 public:
     Environment* parent;
-    std::map<std::string, Value> bindings;
+    Value* slots; // ValType::NONE marks a slot that is not defined yet
+    int size;
+    unsigned mark = 0; // Last collection that reached this frame (see Heap)
 
-    Environment(Environment* p = nullptr) : parent(p) {}
+    static size_t bytesFor(int size) { return sizeof(Environment) + size * sizeof(Value); }
 
-    void define(const std::string& name, Value val) {
-        bindings[name] = val;
+    // Construct a frame with `size` empty slots in a block of bytesFor(size)
+    static Environment* place(void* mem, Environment* p, int size) {
+        Environment* e = new (mem) Environment(p, size);
+        for (int i = 0; i < size; ++i) new (&e->slots[i]) Value();
+        return e;
     }
 
-    Value* lookup(const std::string& name) {
-        auto it = bindings.find(name);
-        if (it != bindings.end()) {
-            return &it->second;
-        }
-        if (parent) {
-            return parent->lookup(name);
-        }
-        return nullptr;
+    // Re-derive `slots` after the frame's bytes were moved (FrameArena::replace)
+    void moved() { slots = reinterpret_cast<Value*>(this + 1); }
+
+    // Frame that is `depth` levels up the static chain
+    Environment* ancestor(int depth) {
+        Environment* e = this;
+        while (depth-- > 0) e = e->parent;
+        return e;
     }
+
+private:
+    Environment(Environment* p, int n)
+        : parent(p), slots(reinterpret_cast<Value*>(this + 1)), size(n) {}
 };
 
 struct FuncData {
-    std::vector<std::string> params;
-    Node* body; // Owned by the AST, not here
+    FunNode* fun;     // Owned by the AST, not here
     Environment* env; // The closure environment
+    unsigned mark = 0;
 
-    FuncData(const std::vector<std::string>& p, Node* b, Environment* e) 
-        : params(p), body(b), env(e) {}
+    FuncData(FunNode* f, Environment* e) : fun(f), env(e) {}
 };
 
 // Implementations of Nodes
 struct NumberNode : Node {
-    int val;
-    NumberNode(int v) : val(v) {}
-    Value eval(Environment* env) override { return Value(val); }
+    Value val; // A fixnum, or a bignum the node owns (see number.h)
+    explicit NumberNode(Value v) : val(v) {}
+    ~NumberNode();
+    Value eval(Environment* env) override { return val; }
 };
 
 struct BoolNode : Node {
@@ -87,26 +201,34 @@ struct BoolNode : Node {
 };
 
 struct VariableNode : Node {
-    std::string name;
-    VariableNode(const std::string& n) : name(n) {}
+    Symbol name;
+    int depth = 0; // Frames to walk up, filled in by the resolver
+    int slot = -1;
+    VariableNode(Symbol n) : name(n) {}
     Value eval(Environment* env) override {
-        Value* v = env->lookup(name);
-        if (!v) {
-            std::cerr << "Error: Variable " << name << " not defined." << std::endl;
-            exit(1);
-        }
-        return *v;
+        const Value& v = env->ancestor(depth)->slots[slot];
+        if (v.isNone()) undefinedError(name);
+        return v;
     }
 };
 
 struct BinaryOpNode : Node {
-    std::string op;
+    OpCode op;
     std::vector<Node*> args; // Variable number of arguments for some ops
+    bool fork = false; // --parallel: evaluate the operands at once (see parallel.h)
 
-    BinaryOpNode(const std::string& o, const std::vector<Node*>& a) : op(o), args(a) {}
+    BinaryOpNode(OpCode o, const std::vector<Node*>& a) : op(o), args(a) {}
     ~BinaryOpNode() { for(auto a : args) delete a; }
     
     Value eval(Environment* env) override; // Defined in implementation
+
+protected:
+    // --parallel: all operands at once, then combine as evalStrict does
+    Value evalForked(Environment* env);
+
+private:
+    // --strict: evaluate all operands first, then check them in order
+    Value evalStrict(Environment* env);
 };
 
 struct IfNode : Node {
@@ -114,6 +236,7 @@ struct IfNode : Node {
     IfNode(Node* t, Node* th, Node* el) : testExp(t), thenExp(th), elseExp(el) {}
     ~IfNode() { delete testExp; delete thenExp; delete elseExp; }
     Value eval(Environment* env) override;
+    Value evalTail(Environment* env, TailCall& tail) override;
 };
 
 struct PrintNode : Node {
@@ -125,9 +248,10 @@ struct PrintNode : Node {
 };
 
 struct DefineNode : Node {
-    std::string name;
+    Symbol name;
+    int slot = -1; // Slot in the frame the definition lives in
     Node* exp;
-    DefineNode(const std::string& n, Node* e) : name(n), exp(e) {}
+    DefineNode(Symbol n, Node* e) : name(n), exp(e) {}
     ~DefineNode() { delete exp; }
     Value eval(Environment* env) override;
 };
@@ -137,22 +261,138 @@ struct BlockNode : Node {
     BlockNode(const std::vector<Node*>& s) : stmts(s) {}
     ~BlockNode() { for(auto s : stmts) delete s; }
     Value eval(Environment* env) override;
+    Value evalTail(Environment* env, TailCall& tail) override;
 };
 
 struct FunNode : Node {
-    std::vector<std::string> params;
+    std::vector<Symbol> params;
     Node* body;
-    FunNode(const std::vector<std::string>& p, Node* b) : params(p), body(b) {}
-    ~FunNode() { delete body; }
+    int frameSize = 0; // Parameters followed by the body's own defines
+    bool frameEscapes = false; // Body creates closures that keep the frame alive
+    // Closure conversion (see Resolver). A closure normally copies the
+    // outer variables its body uses into a record of its own, loaded with
+    // `captures` where the FunNode is evaluated; when there are none it
+    // only needs the global frame. One that may run before such a variable
+    // is defined keeps the frame it is made in instead (capturesFrame).
+    std::vector<VariableNode*> captures;
+    int selfCapture = -1;       // Capture that is the closure itself, filled in after making it
+    bool capturesFrame = false;
+    int outerDepth = 0;         // Frames from where it is made up to the global frame
+    int codeEntry = -1; // Offset of the compiled body in the VM's bytecode (vm.h)
+    std::string name; // Name of the define it is bound to, set by the resolver
+    int profileId = -1; // Index in the --profile tables (profile.h)
+    unsigned mark = 0; // Last collection that reached a closure of it (see Heap::markFunctions)
+    // --jit (jit.h): interpreted calls so far, where compilation stands
+    // (Jit::State), native calls that had to deoptimize, and the code
+    unsigned jitCalls = 0;
+    int jitState = 0;
+    int jitDeopts = 0;
+    void* native = nullptr;
+    FunNode(const std::vector<Symbol>& p, Node* b) : params(p), body(b) {}
+    ~FunNode();
     Value eval(Environment* env) override;
+
+    // Frames from the body's frame up to the global frame
+    int globalDepth() const { return capturesFrame ? outerDepth + 1 : captures.empty() ? 1 : 2; }
+
+    // The frame a closure made in `env` keeps: `env` itself, the global
+    // frame, or a new record for the caller to fill with the captures
+    Environment* closureEnv(Environment* env) const;
 };
 
 struct CallNode : Node {
     Node* funcExp;
     std::vector<Node*> args;
+    int site = -1; // Inline cache slot when the callee is a global (see CallSite)
+    bool fork = false; // --parallel: evaluate the arguments at once (see parallel.h)
     CallNode(Node* f, const std::vector<Node*>& a) : funcExp(f), args(a) {}
     ~CallNode() { delete funcExp; for(auto a : args) delete a; }
     Value eval(Environment* env) override;
+    Value evalTail(Environment* env, TailCall& tail) override;
+
+    // Run the body in `frame`, following tail calls, and release the frame
+    // (also the calls of programs from --emit-cpp, see aot.h)
+    static Value run(FunNode* fun, Environment* frame);
+
+private:
+    // Check the callee and build its frame with the arguments bound
+    Environment* enter(Environment* env, FunNode*& fun);
+    // eval under --memoize or --profile (see memo.h, profile.h)
+    Value evalHooked(Environment* env);
+};
+
+// Inline cache of a CallNode whose callee is a global variable. A global
+// can only be defined once, so the first call that finds a function of the
+// right arity there may keep it, and the next calls skip the lookup and the
+// checks. The caches live in the Runtime (runtime->callSites), indexed by
+// CallNode::site, since every run has globals of its own.
+struct CallSite {
+    FunNode* fun = nullptr; // Null until the first call
+    Environment* env = nullptr; // Captured frame of the closure
+};
+
+// Operators and ifs whose operands the Typer (typer.h) proved to be of the
+// type they need, so eval skips the checks. Every other pass still sees a
+// BinaryOpNode or an IfNode.
+struct AddIntNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct SubIntNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct MulIntNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct DivIntNode : BinaryOpNode { // Still checks for a zero divisor
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct ModIntNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct GreaterIntNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct LessIntNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct EqualIntNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct AndBoolNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct OrBoolNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct NotBoolNode : BinaryOpNode {
+    using BinaryOpNode::BinaryOpNode;
+    Value eval(Environment* env) override;
+};
+
+struct IfBoolNode : IfNode {
+    using IfNode::IfNode;
+    Value eval(Environment* env) override;
+    Value evalTail(Environment* env, TailCall& tail) override;
 };
 
 #endif
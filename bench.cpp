@@ -0,0 +1,78 @@
+#include "bench.h"
+
+#include <iomanip>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+Bench bench;
+
+// Peak resident set size of the process so far, in KiB
+static long peakRSS() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return long(pmc.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return long(usage.ru_maxrss / 1024); // Bytes on macOS
+#else
+    return long(usage.ru_maxrss);
+#endif
+#endif
+}
+
+void Bench::allocations(size_t& count, size_t& bytes) const {
+    count = bytes = 0;
+    if (counter) counter(count, bytes);
+}
+
+void Bench::phase(const char* name) {
+    if (!enabled) return;
+    stop();
+    phases.reserve(8); // Keep our own bookkeeping out of the counts below
+    current = name;
+    allocations(allocsAtBegin, bytesAtBegin);
+    began = std::chrono::steady_clock::now();
+}
+
+void Bench::stop() {
+    if (!current) return;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - began;
+    size_t allocs, bytes;
+    allocations(allocs, bytes);
+    Phase p = {current, elapsed.count(), allocs - allocsAtBegin, bytes - bytesAtBegin, peakRSS()};
+    phases.push_back(p);
+    current = nullptr;
+}
+
+static void printRow(std::ostream& os, const char* name, double ms,
+                     size_t allocs, size_t bytes, long peakKB) {
+    os << std::left << std::setw(10) << name << std::right
+       << std::fixed << std::setprecision(3) << std::setw(13) << ms
+       << std::setw(13) << allocs << std::setw(15) << bytes
+       << std::setw(13) << peakKB << "\n";
+}
+
+void Bench::print(std::ostream& os) const {
+    os << std::left << std::setw(10) << "phase" << std::right
+       << std::setw(13) << "wall ms" << std::setw(13) << "allocs"
+       << std::setw(15) << "bytes" << std::setw(13) << "peak RSS KB" << "\n";
+    double totalMs = 0;
+    size_t totalAllocs = 0, totalBytes = 0;
+    long peak = 0;
+    for (const Phase& p : phases) {
+        printRow(os, p.name, p.ms, p.allocs, p.bytes, p.peakKB);
+        totalMs += p.ms;
+        totalAllocs += p.allocs;
+        totalBytes += p.bytes;
+        if (p.peakKB > peak) peak = p.peakKB;
+    }
+    printRow(os, "total", totalMs, totalAllocs, totalBytes, peak);
+}
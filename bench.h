@@ -0,0 +1,62 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+// Per-phase measurements for --bench: wall time, allocations made through
+// operator new and the peak resident set size reached by the end of the
+// phase. Phases are recorded only once the benchmark is started, so a
+// normal run pays a single branch per phase.
+//
+// Counting allocations takes replacing the global operator new, which is
+// the business of the program, not of libsmli: an application embedding
+// the library keeps its own allocator. The command line replaces it
+// (bench_alloc.cpp) and hands its counter to countAllocations(); without
+// one the allocation columns stay 0.
+class Bench {
+public:
+    void start() { enabled = true; }
+    bool running() const { return enabled; }
+
+    // End the current phase, if any, and start measuring `name`
+    void phase(const char* name);
+
+    // End the current phase
+    void stop();
+
+    void print(std::ostream& os) const;
+
+    struct Phase {
+        const char* name;
+        double ms;
+        size_t allocs;
+        size_t bytes;
+        long peakKB;
+    };
+
+    // The phases ended so far
+    const std::vector<Phase>& recorded() const { return phases; }
+
+    // Reads the allocations made so far by the calling thread
+    typedef void (*AllocationCounter)(size_t& count, size_t& bytes);
+    void countAllocations(AllocationCounter c) { counter = c; }
+
+private:
+    AllocationCounter counter = nullptr;
+
+    bool enabled = false;
+    std::vector<Phase> phases;
+    const char* current = nullptr;
+    std::chrono::steady_clock::time_point began;
+    size_t allocsAtBegin = 0;
+    size_t bytesAtBegin = 0;
+
+    void allocations(size_t& count, size_t& bytes) const;
+};
+
+extern Bench bench;
+
+#endif
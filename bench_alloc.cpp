@@ -0,0 +1,39 @@
+#include "bench_alloc.h"
+
+#include <cstdlib>
+#include <new>
+
+// Every allocation of the interpreter, AST, frames and closures included.
+// Counted per thread, so --batch workers do not race on them; --bench
+// reports the main thread's.
+static thread_local size_t allocCount = 0;
+static thread_local size_t allocBytes = 0;
+
+void threadAllocations(size_t& count, size_t& bytes) {
+    count = allocCount;
+    bytes = allocBytes;
+}
+
+void* operator new(size_t size) {
+    allocCount++;
+    allocBytes += size;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    allocCount++;
+    allocBytes += size;
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
@@ -0,0 +1,11 @@
+#ifndef BENCH_ALLOC_H
+#define BENCH_ALLOC_H
+
+#include <cstddef>
+
+// The allocation counter of --bench (see bench.h). Only the command line
+// links bench_alloc.cpp, which replaces the global operator new and delete
+// to count; libsmli leaves the allocator to whoever links it.
+void threadAllocations(size_t& count, size_t& bytes);
+
+#endif
@@ -0,0 +1,7 @@
+(define ack
+  (fun (m n)
+    (if (= m 0) (+ n 1)
+        (if (= n 0) (ack (- m 1) 1)
+            (ack (- m 1) (ack m (- n 1)))))))
+
+(print-num (ack 3 7))
@@ -0,0 +1,10 @@
+(define poly
+  (fun (x)
+    (+ (* 3 x x) (* 2 x) (mod x 7) (/ x 3) 1)))
+
+(define tree
+  (fun (n)
+    (if (< n 1) (poly n)
+        (- (+ (tree (- n 1)) (tree (- n 2))) (poly n)))))
+
+(print-num (tree 24))
@@ -0,0 +1,18 @@
+(define add1 (fun (x) (+ x 1)))
+
+(define compose
+  (fun (f g)
+    (fun (x) (f (g x)))))
+
+(define chain
+  (fun (n f)
+    (if (= n 0) f
+        (chain (- n 1) (compose add1 f)))))
+
+(define run
+  (fun (i acc)
+    (define deep (chain 1000 add1))
+    (if (= i 0) acc
+        (run (- i 1) (+ acc (deep i))))))
+
+(print-num (run 300 0))
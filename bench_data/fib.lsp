@@ -0,0 +1,6 @@
+(define fib (fun (x)
+  (if (< x 2) x (+
+                 (fib (- x 1))
+                 (fib (- x 2))))))
+
+(print-num (fib 27))
@@ -0,0 +1,19 @@
+(define fold
+  (fun (f acc lo hi)
+    (if (> lo hi) acc
+        (fold f (f acc lo) (+ lo 1) hi))))
+
+(define map-fold
+  (fun (m f acc lo hi)
+    (fold (fun (a x) (f a (m x))) acc lo hi)))
+
+(define square (fun (x) (* (mod x 1000) (mod x 1000))))
+
+(define plus (fun (a b) (mod (+ a b) 1000007)))
+
+(define count-if
+  (fun (p lo hi)
+    (map-fold (fun (x) (if (p x) 1 0)) (fun (a b) (+ a b)) 0 lo hi)))
+
+(print-num (map-fold square plus 0 1 300000))
+(print-num (count-if (fun (x) (= 0 (mod x 3))) 1 300000))
@@ -0,0 +1,20 @@
+(define min
+  (fun (a b)
+    (if (< a b) a b)))
+
+(define max
+  (fun (a b)
+    (if (> a b) a b)))
+
+(define gcd
+  (fun (a b)
+    (if (= 0 (mod (max a b) (min a b)))
+        (min a b)
+        (gcd (min a b) (mod (max a b) (min a b))))))
+
+(define sum-gcd
+  (fun (n acc)
+    (if (< n 2) acc
+        (sum-gcd (- n 1) (+ acc (gcd n 360360))))))
+
+(print-num (sum-gcd 3000 0))
@@ -0,0 +1,26 @@
+(define wide-sum
+  (fun (a b c d)
+    (+ a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d a b c d)))
+
+(define wide-equal
+  (fun (a b)
+    (= a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b a b)))
+
+(define wide-and
+  (fun (p q)
+    (and p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q)))
+
+(define wide-or
+  (fun (p q)
+    (or p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q p q)))
+
+(define loop
+  (fun (i acc)
+    (if (= i 0) acc
+        (loop (- i 1)
+              (+ acc (wide-sum i 1 2 3)
+                 (if (wide-equal i i) 1 0)
+                 (if (wide-and #t (> i 0)) 1 0)
+                 (if (wide-or #f (< i 0)) 1 0))))))
+
+(print-num (loop 200000 0))
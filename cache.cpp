@@ -0,0 +1,398 @@
+#include "cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include "number.h"
+#include "source.h"
+
+namespace {
+
+const uint32_t MAGIC = 0x434c4d53; // "SMLC"
+const uint32_t VERSION = 4;
+
+enum Tag : uint32_t {
+    TAG_NUMBER, TAG_BOOL, TAG_VARIABLE, TAG_OP, TAG_IF, TAG_PRINT,
+    TAG_DEFINE, TAG_BLOCK, TAG_FUN, TAG_CALL, TAG_BIGNUM
+};
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;     // sourceHash of the source
+    uint64_t checksum; // sourceHash of the words that follow
+    uint32_t folded;
+    uint32_t globalCount;
+    uint32_t callSiteCount;
+    uint32_t nameCount;
+    uint32_t statementCount;
+};
+
+class Writer {
+public:
+    std::vector<uint32_t> words;
+    std::vector<Symbol> names; // File index -> symbol
+
+    void write(Node* node);
+    void writeString(const std::string& text);
+
+private:
+    std::unordered_map<Symbol, uint32_t> index;
+
+    uint32_t name(Symbol sym);
+    void put(uint32_t word) { words.push_back(word); }
+    void writeList(const std::vector<Node*>& nodes) {
+        put(uint32_t(nodes.size()));
+        for (Node* n : nodes) write(n);
+    }
+};
+
+uint32_t Writer::name(Symbol sym) {
+    auto it = index.find(sym);
+    if (it != index.end()) return it->second;
+    uint32_t id = uint32_t(names.size());
+    index[sym] = id;
+    names.push_back(sym);
+    return id;
+}
+
+void Writer::writeString(const std::string& text) {
+    put(uint32_t(text.size()));
+    size_t at = words.size();
+    words.resize(at + (text.size() + 3) / 4, 0);
+    if (!text.empty()) std::memcpy(&words[at], text.data(), text.size());
+}
+
+void Writer::write(Node* node) {
+    if (auto num = dynamic_cast<NumberNode*>(node)) {
+        if (num->val.isFixnum()) {
+            put(TAG_NUMBER);
+            put(uint32_t(uint64_t(num->val.num())));
+            put(uint32_t(uint64_t(num->val.num()) >> 32));
+        } else {
+            Bignum* b = num->val.bignum();
+            put(TAG_BIGNUM);
+            put(b->negative);
+            put(b->size);
+            for (uint32_t i = 0; i < b->size; ++i) put(b->limbs()[i]);
+        }
+    } else if (auto b = dynamic_cast<BoolNode*>(node)) {
+        put(TAG_BOOL);
+        put(b->val);
+    } else if (auto var = dynamic_cast<VariableNode*>(node)) {
+        put(TAG_VARIABLE);
+        put(name(var->name));
+        put(uint32_t(var->depth));
+        put(uint32_t(var->slot));
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        put(TAG_OP);
+        put(uint32_t(op->op));
+        writeList(op->args);
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        put(TAG_IF);
+        write(ifn->testExp);
+        write(ifn->thenExp);
+        write(ifn->elseExp);
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        put(TAG_PRINT);
+        put(print->isNum);
+        write(print->exp);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        put(TAG_DEFINE);
+        put(name(def->name));
+        put(uint32_t(def->slot));
+        write(def->exp);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        put(TAG_BLOCK);
+        writeList(block->stmts);
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        put(TAG_FUN);
+        put(uint32_t(fun->params.size()));
+        for (Symbol p : fun->params) put(name(p));
+        put(uint32_t(fun->frameSize));
+        put(fun->frameEscapes);
+        put(fun->capturesFrame);
+        put(uint32_t(fun->outerDepth));
+        put(uint32_t(fun->selfCapture + 1));
+        put(uint32_t(fun->captures.size()));
+        for (VariableNode* var : fun->captures) {
+            put(name(var->name));
+            put(uint32_t(var->depth));
+            put(uint32_t(var->slot));
+        }
+        writeString(fun->name);
+        write(fun->body);
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        put(TAG_CALL);
+        put(uint32_t(call->site + 1));
+        write(call->funcExp);
+        writeList(call->args);
+    }
+}
+
+// Reads words until one runs past the end or a tag or field is out of
+// range; from then on `ok` is false and everything read is 0 or null
+class Reader {
+public:
+    bool ok = true;
+
+    Reader(const uint32_t* begin, const uint32_t* end) : pos(begin), end(end) {}
+
+    uint32_t get() {
+        if (pos == end) {
+            ok = false;
+            return 0;
+        }
+        return *pos++;
+    }
+    bool atEnd() const { return pos == end; }
+    std::string getString();
+    Node* read();
+
+    std::vector<Symbol> names; // File index -> symbol
+    uint32_t callSites = 0;
+
+private:
+    const uint32_t* pos;
+    const uint32_t* end;
+    int nesting = 0;
+
+    Symbol name() {
+        uint32_t id = get();
+        if (id >= names.size()) {
+            ok = false;
+            return 0;
+        }
+        return names[id];
+    }
+    // Number of items that may follow; each takes at least one word
+    uint32_t count() {
+        uint32_t n = get();
+        if (n > uint32_t(end - pos)) {
+            ok = false;
+            return 0;
+        }
+        return n;
+    }
+    void readList(std::vector<Node*>& nodes) {
+        uint32_t n = count();
+        nodes.reserve(n);
+        for (uint32_t i = 0; i < n && ok; ++i) nodes.push_back(read());
+    }
+    Node* node(Node* made) {
+        if (!ok) {
+            delete made;
+            return nullptr;
+        }
+        return made;
+    }
+};
+
+std::string Reader::getString() {
+    uint32_t length = get();
+    size_t wordCount = (size_t(length) + 3) / 4;
+    if (!ok || wordCount > size_t(end - pos)) {
+        ok = false;
+        return std::string();
+    }
+    std::string text(reinterpret_cast<const char*>(pos), length);
+    pos += wordCount;
+    return text;
+}
+
+Node* Reader::read() {
+    // No deeper than the parser's stack lets a source nest
+    if (++nesting > 10000) ok = false;
+    uint32_t tag = get();
+    Node* result = nullptr;
+    if (ok) switch (tag) {
+    case TAG_NUMBER: {
+        uint64_t low = get();
+        int64_t v = int64_t(low | uint64_t(get()) << 32);
+        if (v < Value::FIXNUM_MIN || v > Value::FIXNUM_MAX) ok = false;
+        result = new NumberNode(Value::fixnum(ok ? v : 0));
+        break;
+    }
+    case TAG_BIGNUM: {
+        bool negative = get() != 0;
+        uint32_t size = count();
+        std::vector<uint32_t> limbs(size);
+        for (uint32_t& limb : limbs) limb = get();
+        result = new NumberNode(makeNumber(negative, limbs.data(), size));
+        break;
+    }
+    case TAG_BOOL:
+        result = new BoolNode(get() != 0);
+        break;
+    case TAG_VARIABLE: {
+        VariableNode* var = new VariableNode(name());
+        var->depth = int(get());
+        var->slot = int(get());
+        result = var;
+        break;
+    }
+    case TAG_OP: {
+        uint32_t op = get();
+        if (op > uint32_t(OpCode::NOT)) ok = false;
+        std::vector<Node*> args;
+        readList(args);
+        result = new BinaryOpNode(OpCode(op), args);
+        break;
+    }
+    case TAG_IF: {
+        Node* test = read();
+        Node* then = ok ? read() : nullptr;
+        Node* other = ok ? read() : nullptr;
+        result = new IfNode(test, then, other);
+        break;
+    }
+    case TAG_PRINT: {
+        bool isNum = get() != 0;
+        result = new PrintNode(isNum, read());
+        break;
+    }
+    case TAG_DEFINE: {
+        Symbol sym = name();
+        int slot = int(get());
+        DefineNode* def = new DefineNode(sym, read());
+        def->slot = slot;
+        result = def;
+        break;
+    }
+    case TAG_BLOCK: {
+        std::vector<Node*> stmts;
+        readList(stmts);
+        result = new BlockNode(stmts);
+        break;
+    }
+    case TAG_FUN: {
+        std::vector<Symbol> params(count());
+        for (Symbol& p : params) p = name();
+        int frameSize = int(get());
+        bool frameEscapes = get() != 0;
+        bool capturesFrame = get() != 0;
+        int outerDepth = int(get());
+        int selfCapture = int(get()) - 1;
+        std::vector<VariableNode*> captures(count());
+        for (VariableNode*& var : captures) {
+            var = new VariableNode(name());
+            var->depth = int(get());
+            var->slot = int(get());
+        }
+        if (selfCapture >= int(captures.size())) ok = false;
+        std::string funName = getString();
+        FunNode* fun = new FunNode(params, ok ? read() : nullptr);
+        fun->frameSize = frameSize;
+        fun->frameEscapes = frameEscapes;
+        fun->captures.swap(captures);
+        fun->selfCapture = selfCapture;
+        fun->capturesFrame = capturesFrame;
+        fun->outerDepth = outerDepth;
+        fun->name = funName;
+        result = fun;
+        break;
+    }
+    case TAG_CALL: {
+        uint32_t site = get();
+        if (site > callSites) ok = false;
+        Node* callee = read();
+        std::vector<Node*> args;
+        if (ok) readList(args);
+        CallNode* call = new CallNode(callee, args);
+        call->site = int(site) - 1;
+        result = call;
+        break;
+    }
+    default:
+        ok = false;
+    }
+    --nesting;
+    return node(result);
+}
+
+} // namespace
+
+uint64_t sourceHash(const char* text, size_t length) {
+    // FNV-1a over 8-byte words with a final mix, fast enough to check a
+    // large source against its cache on every run
+    uint64_t h = 14695981039346656037ull ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, text + i, 8);
+        h = (h ^ word) * 1099511628211ull;
+        h ^= h >> 29;
+    }
+    for (; i < length; ++i) h = (h ^ (unsigned char)text[i]) * 1099511628211ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+bool saveCache(const std::string& path, uint64_t hash, bool folded,
+               const std::vector<Node*>& program, int globalCount, int callSites) {
+    Writer body;
+    for (Node* stmt : program) body.write(stmt);
+    Writer table;
+    for (Symbol sym : body.names) table.writeString(symbols.name(sym));
+
+    std::vector<uint32_t>& words = table.words;
+    words.insert(words.end(), body.words.begin(), body.words.end());
+    Header header = {MAGIC, VERSION, hash,
+                     sourceHash(reinterpret_cast<const char*>(words.data()), words.size() * 4),
+                     folded, uint32_t(globalCount), uint32_t(callSites), uint32_t(body.names.size()),
+                     uint32_t(program.size())};
+
+    // Written next to the target and renamed over it, so that a reader
+    // never sees half a file
+    std::string temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1 &&
+              fwrite(words.data(), 4, words.size(), file) == words.size();
+    ok = fclose(file) == 0 && ok;
+    if (ok) {
+        std::remove(path.c_str()); // rename does not replace files on Windows
+        ok = std::rename(temp.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) std::remove(temp.c_str());
+    return ok;
+}
+
+bool loadCache(const std::string& path, uint64_t hash, bool folded,
+               std::vector<Node*>& program, int& globalCount, int& callSites) {
+    SourceBuffer file;
+    if (!file.open(path.c_str()) || file.size() < sizeof(Header) || file.size() % 4 != 0) return false;
+    Header header;
+    std::memcpy(&header, file.data(), sizeof header);
+    const char* rest = file.data() + sizeof header;
+    size_t restBytes = file.size() - sizeof header;
+    if (header.magic != MAGIC || header.version != VERSION || header.hash != hash ||
+        header.folded != uint32_t(folded) || header.checksum != sourceHash(rest, restBytes)) {
+        return false;
+    }
+
+    // The buffer is page aligned, so the words can be read in place
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(rest);
+    Reader reader(words, words + restBytes / 4);
+    reader.callSites = header.callSiteCount;
+    reader.names.reserve(header.nameCount);
+    for (uint32_t i = 0; i < header.nameCount && reader.ok; ++i) {
+        reader.names.push_back(symbols.intern(reader.getString()));
+    }
+
+    std::vector<Node*> statements;
+    for (uint32_t i = 0; i < header.statementCount && reader.ok; ++i) {
+        Node* stmt = reader.read();
+        if (stmt) statements.push_back(stmt);
+    }
+    if (!reader.ok || !reader.atEnd()) {
+        for (Node* stmt : statements) delete stmt;
+        return false;
+    }
+    program.swap(statements);
+    globalCount = int(header.globalCount);
+    callSites = int(header.callSiteCount);
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ast.h"
+
+// --cache: foo.lsp.smlc holds the program of foo.lsp after the resolver
+// and, unless --no-fold, the optimizer, so a later run skips the scanner,
+// the parser and both passes. The file is a header followed by 32-bit
+// words: the names the program uses, then every statement in preorder,
+// each node a tag and its fields followed by its children. Loading maps
+// the file and rebuilds the nodes in one linear pass; symbol ids are
+// process-local, so every name is interned once and the tree refers to
+// names by their index in the file.
+//
+// A cache is used only when the hash of the source, the format version and
+// the fold flag all match; anything else, a damaged file included, makes
+// loadCache fail and the source is parsed again.
+
+// Hash of the source text that keys a cache file
+uint64_t sourceHash(const char* text, size_t length);
+
+// Write `program` to `path`, replacing it atomically; false on I/O errors
+bool saveCache(const std::string& path, uint64_t hash, bool folded,
+               const std::vector<Node*>& program, int globalCount, int callSites);
+
+// Read the program cached for a source of the given hash
+bool loadCache(const std::string& path, uint64_t hash, bool folded,
+               std::vector<Node*>& program, int& globalCount, int& callSites);
+
+#endif
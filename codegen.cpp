@@ -0,0 +1,436 @@
+#include "codegen.h"
+
+#include <typeinfo>
+#include "number.h"
+
+namespace {
+
+const char* opName(OpCode op) {
+    switch (op) {
+    case OpCode::ADD: return "OpCode::ADD";
+    case OpCode::SUB: return "OpCode::SUB";
+    case OpCode::MUL: return "OpCode::MUL";
+    case OpCode::DIV: return "OpCode::DIV";
+    case OpCode::MOD: return "OpCode::MOD";
+    case OpCode::GREATER: return "OpCode::GREATER";
+    case OpCode::SMALLER: return "OpCode::SMALLER";
+    case OpCode::EQUAL: return "OpCode::EQUAL";
+    case OpCode::AND: return "OpCode::AND";
+    case OpCode::OR: return "OpCode::OR";
+    case OpCode::NOT: return "OpCode::NOT";
+    }
+    return "";
+}
+
+std::string quoted(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Whether evaluating `node` can reach a safe point; making a closure
+// allocates, but only a call collects
+bool makesCalls(Node* node) {
+    if (dynamic_cast<CallNode*>(node)) return true;
+    if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        for (Node* arg : op->args) if (makesCalls(arg)) return true;
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        return makesCalls(ifn->testExp) || makesCalls(ifn->thenExp) || makesCalls(ifn->elseExp);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (Node* stmt : block->stmts) if (makesCalls(stmt)) return true;
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        return makesCalls(def->exp);
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        return makesCalls(print->exp);
+    }
+    return false;
+}
+
+} // namespace
+
+void CodeGen::line(const std::string& text) {
+    code.append(size_t(indent) * 4, ' ');
+    code += text;
+    code += '\n';
+}
+
+std::string CodeGen::temp() {
+    return "t" + std::to_string(temps++);
+}
+
+std::string CodeGen::name(Symbol symbol) {
+    auto found = nameIds.find(symbol);
+    if (found == nameIds.end()) {
+        found = nameIds.insert(std::make_pair(symbol, int(names.size()))).first;
+        names.push_back(symbol);
+    }
+    return "sym[" + std::to_string(found->second) + "]";
+}
+
+std::string CodeGen::function(FunNode* fun) {
+    auto found = functionIds.find(fun);
+    if (found == functionIds.end()) {
+        found = functionIds.insert(std::make_pair(fun, int(functions.size()))).first;
+        functions.push_back(fun);
+    }
+    return "fun[" + std::to_string(found->second) + "]";
+}
+
+bool CodeGen::simple(Node* node, std::string& expr) {
+    if (auto num = dynamic_cast<NumberNode*>(node)) {
+        if (num->val.isFixnum()) {
+            expr = "Value::fixnum(" + std::to_string(num->val.num()) + ")";
+        } else {
+            expr = "lit[" + std::to_string(literals.size()) + "]";
+            literals.push_back(num->val);
+        }
+        return true;
+    } else if (auto b = dynamic_cast<BoolNode*>(node)) {
+        expr = b->val ? "Value(true)" : "Value(false)";
+        return true;
+    } else if (auto var = dynamic_cast<VariableNode*>(node)) {
+        expr = "aot::load(env, " + std::to_string(var->depth) + ", " + std::to_string(var->slot) + ", " +
+               name(var->name) + ")";
+        return true;
+    }
+    return false;
+}
+
+std::string CodeGen::value(Node* node) {
+    std::string t = temp(), expr;
+    if (simple(node, expr)) {
+        line("Value " + t + " = " + expr + ";");
+    } else {
+        line("Value " + t + ";");
+        gen(node, t);
+    }
+    return t;
+}
+
+std::string CodeGen::valueKeeping(Node* node, const std::string& held) {
+    if (!makesCalls(node)) return value(node);
+    std::string t = temp();
+    line("Value " + t + ";");
+    open();
+    line("TempRoots held;");
+    line("held.keep(" + held + ");");
+    gen(node, t);
+    close();
+    return t;
+}
+
+void CodeGen::gen(Node* node, const std::string& dst, bool tail) {
+    std::string expr;
+    if (simple(node, expr)) {
+        line(dst + " = " + expr + ";");
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        open();
+        if (typeid(*op) == typeid(BinaryOpNode)) {
+            genOperator(op, dst);
+        } else {
+            genTyped(op, dst);
+        }
+        close();
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        open();
+        std::string test = value(ifn->testExp);
+        if (!dynamic_cast<IfBoolNode*>(ifn)) line("checkBool(" + test + ");");
+        line("if (" + test + ".boolean()) {");
+        ++indent;
+        gen(ifn->thenExp, dst, tail);
+        --indent;
+        line("} else {");
+        ++indent;
+        gen(ifn->elseExp, dst, tail);
+        close();
+        close();
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        open();
+        std::string v = value(print->exp);
+        if (print->isNum) {
+            line("checkNumber(" + v + ");");
+            line("printNumber(runtime->out, " + v + ");");
+        } else {
+            line("checkBool(" + v + ");");
+            line("runtime->out.printBool(" + v + ".boolean());");
+        }
+        close();
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        open();
+        std::string v = value(def->exp);
+        line("aot::define(env, " + std::to_string(def->slot) + ", " + v + ", " + name(def->name) + ");");
+        close();
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (size_t i = 0; i + 1 < block->stmts.size(); ++i) statement(block->stmts[i]);
+        gen(block->stmts.back(), dst, tail);
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        line(dst + " = " + function(fun) + "->eval(env);");
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        genCall(call, dst, tail);
+    }
+}
+
+void CodeGen::statement(Node* stmt) {
+    // Defines and prints have no value
+    if (dynamic_cast<DefineNode*>(stmt) || dynamic_cast<PrintNode*>(stmt)) {
+        gen(stmt, std::string());
+        return;
+    }
+    open();
+    std::string t = temp();
+    line("Value " + t + ";");
+    gen(stmt, t);
+    close();
+}
+
+void CodeGen::genOperator(BinaryOpNode* op, const std::string& dst) {
+    const std::vector<Node*>& args = op->args;
+    std::string n = std::to_string(args.size());
+    if (strictEval) {
+        std::string values = temp();
+        line("Value " + values + "[" + n + "];");
+        line("TempRoots held;");
+        for (size_t i = 0; i < args.size(); ++i) {
+            std::string v = values + "[" + std::to_string(i) + "]";
+            gen(args[i], v);
+            line("held.keep(" + v + ");");
+        }
+        line(dst + " = combineOperands(" + opName(op->op) + ", " + values + ", " + n + ");");
+        return;
+    }
+
+    switch (op->op) {
+    case OpCode::ADD:
+    case OpCode::MUL: {
+        std::string acc = temp();
+        line("Value " + acc + (op->op == OpCode::ADD ? " = Value(0);" : " = Value(1);"));
+        for (Node* arg : args) {
+            std::string v = valueKeeping(arg, acc);
+            line("checkNumber(" + v + ");");
+            line(acc + (op->op == OpCode::ADD ? " = numAdd(" : " = numMul(") + acc + ", " + v + ");");
+        }
+        line(dst + " = " + acc + ";");
+        return;
+    }
+    case OpCode::EQUAL: {
+        std::string first = value(args[0]);
+        line("checkNumber(" + first + ");");
+        line(dst + " = Value(true);");
+        line("do {");
+        ++indent;
+        for (size_t i = 1; i < args.size(); ++i) {
+            std::string v = valueKeeping(args[i], first);
+            line("checkNumber(" + v + ");");
+            line("if (!numEqual(" + v + ", " + first + ")) {");
+            line("    " + dst + " = Value(false);");
+            line("    break;");
+            line("}");
+        }
+        --indent;
+        line("} while (false);");
+        return;
+    }
+    case OpCode::AND:
+    case OpCode::OR: {
+        bool isAnd = op->op == OpCode::AND;
+        line(dst + (isAnd ? " = Value(true);" : " = Value(false);"));
+        line("do {");
+        ++indent;
+        for (Node* arg : args) {
+            std::string v = value(arg);
+            line("checkBool(" + v + ");");
+            line(std::string("if (") + (isAnd ? "!" : "") + v + ".boolean()) {");
+            line("    " + dst + (isAnd ? " = Value(false);" : " = Value(true);"));
+            line("    break;");
+            line("}");
+        }
+        --indent;
+        line("} while (false);");
+        return;
+    }
+    case OpCode::NOT: {
+        std::string v = value(args[0]);
+        line("checkBool(" + v + ");");
+        line(dst + " = Value(!" + v + ".boolean());");
+        return;
+    }
+    default:
+        break;
+    }
+
+    // Both operands, then the checks
+    std::string values = temp();
+    line("Value " + values + "[2];");
+    gen(args[0], values + "[0]");
+    if (makesCalls(args[1])) {
+        open();
+        line("TempRoots held;");
+        line("held.keep(" + values + "[0]);");
+        gen(args[1], values + "[1]");
+        close();
+    } else {
+        gen(args[1], values + "[1]");
+    }
+    line(dst + " = combineOperands(" + opName(op->op) + ", " + values + ", 2);");
+}
+
+void CodeGen::genTyped(BinaryOpNode* op, const std::string& dst) {
+    const std::vector<Node*>& args = op->args;
+    bool isAdd = dynamic_cast<AddIntNode*>(op) != nullptr;
+    if (isAdd || dynamic_cast<MulIntNode*>(op)) {
+        std::string acc = temp();
+        line("Value " + acc + (isAdd ? " = Value(0);" : " = Value(1);"));
+        for (Node* arg : args) {
+            std::string v = valueKeeping(arg, acc);
+            line(acc + (isAdd ? " = numAdd(" : " = numMul(") + acc + ", " + v + ");");
+        }
+        line(dst + " = " + acc + ";");
+    } else if (dynamic_cast<EqualIntNode*>(op)) {
+        std::string first = value(args[0]);
+        line(dst + " = Value(true);");
+        line("do {");
+        ++indent;
+        for (size_t i = 1; i < args.size(); ++i) {
+            std::string v = valueKeeping(args[i], first);
+            line("if (!numEqual(" + v + ", " + first + ")) {");
+            line("    " + dst + " = Value(false);");
+            if (!strictEval) line("    break;");
+            line("}");
+        }
+        --indent;
+        line("} while (false);");
+    } else if (dynamic_cast<AndBoolNode*>(op) || dynamic_cast<OrBoolNode*>(op)) {
+        bool isAnd = dynamic_cast<AndBoolNode*>(op) != nullptr;
+        line(dst + (isAnd ? " = Value(true);" : " = Value(false);"));
+        line("do {");
+        ++indent;
+        for (Node* arg : args) {
+            std::string v = value(arg);
+            line(std::string("if (") + (isAnd ? "!" : "") + v + ".boolean()) {");
+            line("    " + dst + (isAnd ? " = Value(false);" : " = Value(true);"));
+            if (!strictEval) line("    break;");
+            line("}");
+        }
+        --indent;
+        line("} while (false);");
+    } else if (dynamic_cast<NotBoolNode*>(op)) {
+        std::string v = value(args[0]);
+        line(dst + " = Value(!" + v + ".boolean());");
+    } else {
+        std::string a = value(args[0]);
+        std::string b = valueKeeping(args[1], a);
+        if (dynamic_cast<SubIntNode*>(op)) {
+            line(dst + " = numSub(" + a + ", " + b + ");");
+        } else if (dynamic_cast<DivIntNode*>(op)) {
+            line("if (numIsZero(" + b + ")) divisionByZeroError();");
+            line(dst + " = numDiv(" + a + ", " + b + ");");
+        } else if (dynamic_cast<ModIntNode*>(op)) {
+            line("if (numIsZero(" + b + ")) divisionByZeroError();");
+            line(dst + " = numMod(" + a + ", " + b + ");");
+        } else if (dynamic_cast<GreaterIntNode*>(op)) {
+            line(dst + " = Value(numLess(" + b + ", " + a + "));");
+        } else {
+            line(dst + " = Value(numLess(" + a + ", " + b + "));");
+        }
+    }
+}
+
+void CodeGen::genCall(CallNode* call, const std::string& dst, bool tail) {
+    open();
+    // Nothing is half-evaluated here, as in CallNode::enter
+    line("runtime->heap.safePoint();");
+    std::string callee = value(call->funcExp);
+    std::string fun = "c" + std::to_string(temps), frame = "f" + std::to_string(temps);
+    ++temps;
+    line("FunNode* " + fun + ";");
+    line("Environment* " + frame + " = aot::enter(" + callee + ", " + std::to_string(call->args.size()) + ", " +
+         fun + ");");
+    for (size_t i = 0; i < call->args.size(); ++i) {
+        gen(call->args[i], frame + "->slots[" + std::to_string(i) + "]");
+    }
+    if (tail) {
+        line("tail.fun = " + fun + ";");
+        line("tail.frame = " + frame + ";");
+        line(dst + " = Value();");
+    } else {
+        line(dst + " = CallNode::run(" + fun + ", " + frame + ");");
+    }
+    close();
+}
+
+void CodeGen::emit(const std::vector<Node*>& statements, int globalCount, std::ostream& os) {
+    // The top level first, then the bodies of the functions as they are
+    // found, which may find more
+    code.clear();
+    indent = 1;
+    temps = 0;
+    for (Node* stmt : statements) statement(stmt);
+    std::string program = code;
+
+    std::vector<std::string> bodies;
+    for (size_t i = 0; i < functions.size(); ++i) {
+        code.clear();
+        temps = 0;
+        line("Value r;");
+        gen(functions[i]->body, "r", true);
+        line("return r;");
+        bodies.push_back(code);
+    }
+    // The startup code names these too
+    for (FunNode* fun : functions) {
+        for (VariableNode* var : fun->captures) name(var->name);
+    }
+
+    os << "// Generated by smli --emit-cpp. Build it with the smli library:\n"
+          "//   g++ -std=c++11 -O2 -I<smli> program.cpp <smli>/libsmli.a -pthread\n"
+          "// (and -lpsapi on Windows, as compile.ps1 links minilisp.exe)\n"
+          "#include \"aot.h\"\n\n"
+          "namespace {\n\n";
+    if (!names.empty()) os << "Symbol sym[" << names.size() << "];\n";
+    if (!literals.empty()) os << "Value lit[" << literals.size() << "];\n";
+    if (!functions.empty()) os << "FunNode* fun[" << functions.size() << "];\n";
+    os << "\n";
+    for (size_t i = 0; i < functions.size(); ++i) {
+        os << "Value body" << i << "(Environment* env, TailCall& tail);\n";
+    }
+    for (size_t i = 0; i < functions.size(); ++i) {
+        os << "\n// " << (functions[i]->name.empty() ? "lambda" : functions[i]->name) << "\n"
+           << "Value body" << i << "(Environment* env, TailCall& tail) {\n" << bodies[i] << "}\n";
+    }
+    os << "\nvoid program(Environment* env) {\n" << program << "}\n\n";
+
+    os << "void setup() {\n";
+    if (!names.empty()) {
+        os << "    static const char* const names[] = {";
+        for (size_t i = 0; i < names.size(); ++i) os << (i ? ", " : "") << quoted(symbols.name(names[i]));
+        os << "};\n"
+           << "    for (int i = 0; i < " << names.size() << "; ++i) sym[i] = symbols.intern(names[i]);\n";
+    }
+    for (size_t i = 0; i < literals.size(); ++i) {
+        std::string text = numberText(literals[i]);
+        os << "    lit[" << i << "] = parseNumber(" << quoted(text) << ", " << text.size() << ");\n";
+    }
+    for (size_t i = 0; i < functions.size(); ++i) {
+        FunNode* fun = functions[i];
+        std::string f = "    fun[" + std::to_string(i) + "]";
+        os << f << " = aot::function(body" << i << ", " << fun->params.size() << ", " << quoted(fun->name) << ");\n";
+        os << f << "->frameSize = " << fun->frameSize << ";\n";
+        if (fun->frameEscapes) os << f << "->frameEscapes = true;\n";
+        if (fun->capturesFrame) os << f << "->capturesFrame = true;\n";
+        if (fun->outerDepth) os << f << "->outerDepth = " << fun->outerDepth << ";\n";
+        if (fun->selfCapture >= 0) os << f << "->selfCapture = " << fun->selfCapture << ";\n";
+        for (VariableNode* var : fun->captures) {
+            os << "    aot::capture(fun[" << i << "], " << name(var->name) << ", " << var->depth << ", " << var->slot
+               << ");\n";
+        }
+    }
+    os << "}\n\n"
+          "} // namespace\n\n"
+          "int main() {\n"
+          "    setup();\n"
+          "    return aot::run(" << globalCount << ", program);\n"
+          "}\n";
+}
@@ -0,0 +1,59 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "ast.h"
+
+// Ahead-of-time compiler for --emit-cpp: writes the resolved, folded and
+// typed program as a C++ program that links against the smli library and
+// runs on its runtime (see aot.h). Every function body becomes a C++
+// function and the top-level statements another one.
+//
+// Each node is translated into the statements its eval runs, in the same
+// order, with the same checks and the same errors: the operators fold,
+// short-circuit or, under --strict, evaluate everything first as they do in
+// interpreter.cpp, the Typer's nodes skip their checks, and a bignum held
+// while a later operand can reach a safe point is kept in a TempRoots. A
+// call in tail position of a body hands its frame back through `tail`.
+// What the generator was run with (--strict, --no-fold, --no-infer) is
+// therefore fixed in the output.
+class CodeGen {
+public:
+    void emit(const std::vector<Node*>& statements, int globalCount, std::ostream& os);
+
+private:
+    std::string code;   // Of the function being generated
+    int indent = 0;
+    int temps = 0;      // Locals of the function being generated
+    std::vector<FunNode*> functions;     // In order of their bodies, body<i>
+    std::map<FunNode*, int> functionIds;
+    std::vector<Value> literals;         // Bignums, lit[i]
+    std::vector<Symbol> names;           // For errors and captures, sym[i]
+    std::map<Symbol, int> nameIds;
+
+    void line(const std::string& text);
+    void open() { line("{"); ++indent; }
+    void close() { --indent; line("}"); }
+    std::string temp();
+    std::string name(Symbol symbol);
+    std::string function(FunNode* fun);
+
+    // Code that evaluates `node` into `dst`
+    void gen(Node* node, const std::string& dst, bool tail = false);
+    // Code that evaluates `stmt` for its effects
+    void statement(Node* stmt);
+    void genOperator(BinaryOpNode* op, const std::string& dst);
+    void genTyped(BinaryOpNode* op, const std::string& dst);
+    void genCall(CallNode* call, const std::string& dst, bool tail);
+    // A new local holding the value of `node`
+    std::string value(Node* node);
+    // The same while `held` stays reachable
+    std::string valueKeeping(Node* node, const std::string& held);
+    // C++ expression for a node that reads no more than a literal or a variable
+    bool simple(Node* node, std::string& expr);
+};
+
+#endif
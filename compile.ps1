@@ -4,10 +4,35 @@ bison -d parser.y
 Write-Host "Compiling Flex..."
 flex scanner.l
 
+# smli 函式庫: 直譯器本體 (minilisp.h 為對外 API)，main.cpp 只負責命令列
+$libSources = @("interpreter.cpp", "minilisp.cpp", "runtime.cpp", "output.cpp", "number.cpp", "kernels.cpp", "pool.cpp", "parallel.cpp", "jit.cpp", "aot.cpp", "codegen.cpp", "server.cpp", "stats.cpp", "resolver.cpp", "optimizer.cpp",
+                "heap.cpp", "vm.cpp", "bench.cpp", "memo.cpp", "profile.cpp", "parse.cpp", "source.cpp",
+                "symbols.cpp", "cache.cpp", "typer.cpp", "parser.tab.c", "lex.yy.c")
+$flags = @("-std=c++11", "-Wno-write-strings", "-pthread")
+
+Write-Host "Compiling libsmli..."
+$objects = @()
+$ok = $true
+foreach ($src in $libSources) {
+    $obj = [System.IO.Path]::ChangeExtension($src, ".o")
+    g++ -c $src -o $obj @flags
+    if (-not $?) { $ok = $false }
+    $objects += $obj
+}
+if ($ok) {
+    Remove-Item libsmli.a -ErrorAction SilentlyContinue
+    ar rcs libsmli.a @objects
+    $ok = $?
+}
+
 Write-Host "Compiling C++..."
-g++ -o minilisp.exe interpreter.cpp parser.tab.c lex.yy.c -std=c++11 -Wno-write-strings
+if ($ok) {
+    # bench_alloc.cpp 取代全域 operator new 以計算配置次數，只連結進 minilisp.exe
+    g++ -o minilisp.exe main.cpp bench_alloc.cpp libsmli.a @flags -lpsapi
+    $ok = $?
+}
 
-if ($?) {
+if ($ok) {
     Write-Host "Build Successful! Run ./minilisp.exe <file.lsp>"
 } else {
     Write-Host "Build Failed."
@@ -0,0 +1,207 @@
+#include "heap.h"
+
+#include <cstring>
+#include <new>
+#include "memo.h"
+#include "number.h"
+
+Heap::~Heap() {
+    for (FuncData* f : closures) delete f;
+    for (Environment* e : heapFrames) ::operator delete(e);
+    for (Bignum* b : bignums) ::operator delete(b);
+}
+
+void Heap::allocated(size_t bytes) {
+    counters.bytesAllocated += bytes;
+    counters.liveBytes += bytes;
+    if (counters.liveBytes > counters.peakLiveBytes) {
+        counters.peakLiveBytes = counters.liveBytes;
+    }
+    sinceCollect += bytes;
+}
+
+FuncData* Heap::newClosure(FunNode* fun, Environment* env) {
+    FuncData* f = new FuncData(fun, env);
+    closures.push_back(f);
+    counters.closuresAllocated++;
+    allocated(sizeof(FuncData));
+    return f;
+}
+
+Environment* Heap::newFrame(Environment* parent, int size) {
+    size_t bytes = Environment::bytesFor(size);
+    Environment* e = Environment::place(::operator new(bytes), parent, size);
+    heapFrames.push_back(e);
+    counters.framesAllocated++;
+    allocated(bytes);
+    return e;
+}
+
+Bignum* Heap::newBignum(uint32_t size) {
+    size_t bytes = Bignum::bytesFor(size);
+    Bignum* b = new (::operator new(bytes)) Bignum();
+    b->permanent = false;
+    b->size = size;
+    bignums.push_back(b);
+    counters.bignumsAllocated++;
+    allocated(bytes);
+    return b;
+}
+
+void Heap::markValue(const Value& v) {
+    if (v.isBignum()) {
+        // Those of literals are shared with other runtimes and not ours
+        if (!v.bignum()->permanent && !foreign(v.bignum())) v.bignum()->mark = epoch;
+        return;
+    }
+    if (!v.isFunction()) return;
+    FuncData* f = v.func();
+    if (foreign(f) || f->mark == epoch) return;
+    f->mark = epoch;
+    if (functionMarks) f->fun->mark = epoch;
+    markFrame(f->env);
+}
+
+void Heap::markFrame(Environment* frame) {
+    if (frame && !foreign(frame) && frame->mark != epoch) {
+        frame->mark = epoch;
+        gray.push_back(frame);
+    }
+}
+
+void Heap::collect(const Value* stackBegin, const Value* stackEnd) {
+    // A fresh epoch means nothing is marked yet, and arena frames, which
+    // are never swept, need no clearing afterwards
+    ++epoch;
+    if (shared) {
+        owned.insert(closures.begin(), closures.end());
+        owned.insert(heapFrames.begin(), heapFrames.end());
+        owned.insert(bignums.begin(), bignums.end());
+    }
+    // Always ours; the frame arena's are in no list, and a frame on it is
+    // only reached as a root
+    for (Environment* r : roots) {
+        if (r->mark != epoch) {
+            r->mark = epoch;
+            gray.push_back(r);
+        }
+    }
+    for (const Value* v = stackBegin; v != stackEnd; ++v) markValue(*v);
+    for (const Value& v : temps) markValue(v);
+    while (!gray.empty()) {
+        Environment* e = gray.back();
+        gray.pop_back();
+        markFrame(e->parent);
+        for (int i = 0; i < e->size; ++i) markValue(e->slots[i]);
+    }
+    owned.clear();
+
+    // Cached results must not outlive the environment they are keyed by
+    if (cache && cache->enabled()) cache->sweep(epoch);
+
+    size_t freedBytes = 0;
+    size_t kept = 0;
+    for (FuncData* f : closures) {
+        if (f->mark == epoch) {
+            closures[kept++] = f;
+        } else {
+            delete f;
+            freedBytes += sizeof(FuncData);
+            counters.objectsFreed++;
+        }
+    }
+    closures.resize(kept);
+    kept = 0;
+    for (Environment* e : heapFrames) {
+        if (e->mark == epoch) {
+            heapFrames[kept++] = e;
+        } else {
+            freedBytes += Environment::bytesFor(e->size);
+            ::operator delete(e);
+            counters.objectsFreed++;
+        }
+    }
+    heapFrames.resize(kept);
+    kept = 0;
+    for (Bignum* b : bignums) {
+        if (b->mark == epoch) {
+            bignums[kept++] = b;
+        } else {
+            freedBytes += Bignum::bytesFor(b->size);
+            ::operator delete(b);
+            counters.objectsFreed++;
+        }
+    }
+    bignums.resize(kept);
+
+    counters.collections++;
+    counters.liveBytes -= freedBytes;
+    sinceCollect = 0;
+    threshold = counters.liveBytes > MIN_THRESHOLD ? counters.liveBytes : MIN_THRESHOLD;
+}
+
+void Heap::printStats(std::ostream& os) const {
+    os << "Heap statistics:" << std::endl
+       << "  closures allocated: " << counters.closuresAllocated << std::endl
+       << "  frames allocated:   " << counters.framesAllocated << std::endl
+       << "  bignums allocated:  " << counters.bignumsAllocated << std::endl
+       << "  bytes allocated:    " << counters.bytesAllocated << std::endl
+       << "  collections:        " << counters.collections << std::endl
+       << "  objects freed:      " << counters.objectsFreed << std::endl
+       << "  live bytes:         " << counters.liveBytes << std::endl
+       << "  peak live bytes:    " << counters.peakLiveBytes << std::endl;
+}
+
+FrameArena::~FrameArena() {
+    for (auto& c : chunks) delete[] c.begin;
+}
+
+void FrameArena::nextChunk(size_t bytes) {
+    if (top) ++current;
+    // Reuse a chunk left over from earlier, deeper calls when it is big enough
+    while (current < chunks.size() && size_t(chunks[current].end - chunks[current].begin) < bytes) {
+        delete[] chunks[current].begin;
+        chunks.erase(chunks.begin() + current);
+    }
+    if (current == chunks.size()) {
+        size_t n = bytes > CHUNK_BYTES ? bytes : CHUNK_BYTES;
+        char* mem = new char[n];
+        chunks.push_back(Chunk{mem, mem + n});
+    }
+    top = chunks[current].begin;
+}
+
+Environment* FrameArena::push(Environment* parent, int size) {
+    size_t bytes = Environment::bytesFor(size);
+    if (!top || size_t(chunks[current].end - top) < bytes) {
+        nextChunk(bytes);
+    }
+    Environment* e = Environment::place(top, parent, size);
+    top += bytes;
+    ++pushed;
+    return e;
+}
+
+void FrameArena::pop(Environment* frame) {
+    char* p = reinterpret_cast<char*>(frame);
+    while (p < chunks[current].begin || p >= chunks[current].end) {
+        --current;
+    }
+    top = p;
+}
+
+Environment* FrameArena::replace(Environment* old, Environment* frame) {
+    size_t bytes = Environment::bytesFor(frame->size);
+    pop(old);
+    if (size_t(chunks[current].end - top) < bytes) {
+        // Cannot lie below `frame`'s own chunk, which is big enough
+        nextChunk(bytes);
+    }
+    Environment* e = reinterpret_cast<Environment*>(top);
+    if (e != frame) {
+        std::memmove(static_cast<void*>(e), frame, bytes);
+        e->moved();
+    }
+    top += bytes;
+    return e;
+}
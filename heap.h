@@ -0,0 +1,145 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <cstddef>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+#include "ast.h"
+
+class Memo;
+
+// Mark-sweep collector for closures (FuncData), the frames they capture and
+// the bignums of arithmetic results (number.h).
+//
+// Roots are the frames on the root stack: the global frame and the frame of
+// every call that is still running, arena frames included since their slots
+// can hold closures. Collection only happens at safePoint(), which
+// CallNode::eval reaches before evaluating anything, so every closure the
+// interpreter still needs is reachable from a root at that moment. The VM
+// also passes its operand stack, which holds values the tree walker would
+// keep in C++ locals; the few such locals that can be a bignum while a call
+// runs are pushed as temporary roots (see TempRoots in runtime.h).
+class Heap {
+public:
+    struct Stats {
+        size_t closuresAllocated = 0;
+        size_t framesAllocated = 0;
+        size_t bignumsAllocated = 0;
+        size_t bytesAllocated = 0;
+        size_t collections = 0;
+        size_t objectsFreed = 0;
+        size_t liveBytes = 0;
+        size_t peakLiveBytes = 0;
+    };
+
+    Heap() = default;
+    ~Heap();
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    FuncData* newClosure(FunNode* fun, Environment* env);
+    Environment* newFrame(Environment* parent, int size);
+    Bignum* newBignum(uint32_t size);
+
+    void pushRoot(Environment* frame) { roots.push_back(frame); }
+    void popRoot() { roots.pop_back(); }
+    size_t rootCount() const { return roots.size(); }
+    void popRoots(size_t count) { roots.resize(count); }
+    // Swap the top root for `frame`, as a tail call does with its frame
+    void replaceRoot(Environment* frame) { roots.back() = frame; }
+
+    void pushTemp(Value v) { temps.push_back(v); }
+    void popTemps(size_t count) { temps.resize(count); }
+    size_t tempCount() const { return temps.size(); }
+
+    void safePoint(const Value* stackBegin = nullptr, const Value* stackEnd = nullptr) {
+        if (sinceCollect >= threshold) collect(stackBegin, stackEnd);
+    }
+    void collect(const Value* stackBegin = nullptr, const Value* stackEnd = nullptr);
+
+    // Number of the last collection; FuncData and Environment marks equal
+    // to it were reached by that collection
+    unsigned lastEpoch() const { return epoch; }
+
+    // Also mark the FunNode of every closure reached. Off by default, since
+    // the AST of a Program may be shared by runtimes on other threads.
+    void markFunctions(bool on) { functionMarks = on; }
+
+    // Closures, frames and bignums of other runtimes may be reachable from
+    // ours (--parallel, see parallel.h). Their owners keep them alive, so
+    // collections leave them alone and only mark objects of this heap.
+    void shareObjects() { shared = true; }
+
+    // Result cache whose entries die with the frames they are keyed by
+    void attachCache(Memo* memo) { cache = memo; }
+
+    const Stats& stats() const { return counters; }
+    void printStats(std::ostream& os) const;
+
+private:
+    static const size_t MIN_THRESHOLD = 1024 * 1024;
+
+    std::vector<FuncData*> closures;
+    std::vector<Environment*> heapFrames;
+    std::vector<Bignum*> bignums;
+    std::vector<Environment*> roots;
+    std::vector<Value> temps;
+    std::vector<Environment*> gray; // Frames reached but not scanned yet
+    unsigned epoch = 0;
+    size_t sinceCollect = 0;
+    size_t threshold = MIN_THRESHOLD;
+    Stats counters;
+    Memo* cache = nullptr;
+    bool functionMarks = false;
+    bool shared = false;
+    std::unordered_set<const void*> owned; // Our objects, while a shared heap collects
+
+    void allocated(size_t bytes);
+    void markValue(const Value& v);
+    void markFrame(Environment* frame);
+    bool foreign(const void* object) const { return shared && !owned.count(object); }
+};
+
+// Bump allocator for call frames that cannot escape (the resolver clears
+// FunNode::frameEscapes unless a closure made in the body keeps the frame,
+// see Resolver). Such frames die
+// in strict LIFO order, so a call pushes its frame and pops it on return,
+// and consecutive frames sit next to each other in large chunks that are
+// kept around for reuse.
+class FrameArena {
+public:
+    FrameArena() = default;
+    ~FrameArena();
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    Environment* push(Environment* parent, int size);
+
+    // Release `frame` and everything pushed after it
+    void pop(Environment* frame);
+
+    // Release `old` and everything above it except `frame`, the topmost
+    // frame, which slides down into the freed space. Used for tail calls.
+    Environment* replace(Environment* old, Environment* frame);
+
+    // Frames pushed so far
+    size_t pushes() const { return pushed; }
+
+private:
+    struct Chunk {
+        char* begin;
+        char* end;
+    };
+
+    static const size_t CHUNK_BYTES = 64 * 1024;
+
+    std::vector<Chunk> chunks;
+    size_t current = 0;  // Index of the chunk `top` points into
+    char* top = nullptr;
+    size_t pushed = 0;
+
+    void nextChunk(size_t bytes);
+};
+
+#endif
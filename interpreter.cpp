@@ -1,129 +1,405 @@
 #include <iostream>
 #include <vector>
 #include <numeric>
+#include <cstdlib>
+#include <algorithm>
 #include "ast.h"
-#include "parser.tab.h"
-
-extern std::vector<Node*> program;
-extern "C" FILE* yyin;
-extern "C" int yyparse();
+#include "heap.h"
+#include "jit.h"
+#include "kernels.h"
+#include "memo.h"
+#include "number.h"
+#include "parallel.h"
+#include "profile.h"
+#include "runtime.h"
 
 // Helper for Type Checking
 void typeError(const std::string& expect, const std::string& got) {
-    std::cout << "Type Error: Expect '" << expect << "' but got '" << got << "'." << std::endl;
-    exit(0);
+    throw ProgramError{"Type Error: Expect '" + expect + "' but got '" + got + "'.", false, 0};
 }
 
-void checkNumber(const Value& v) {
-    if (v.type != ValType::NUMBER) {
-        std::string got = (v.type == ValType::BOOLEAN) ? "boolean" : "function"; // Simple mapping
-        typeError("number", got);
-    }
+// Slow paths of checkNumber/checkBool (ast.h)
+void numberTypeError(const Value& v) {
+    std::string got = v.isBool() ? "boolean" : "function"; // Simple mapping
+    typeError("number", got);
 }
 
-void checkBool(const Value& v) {
-    if (v.type != ValType::BOOLEAN) {
-        std::string got = (v.type == ValType::NUMBER) ? "number" : "function";
-        typeError("boolean", got);
+void boolTypeError(const Value& v) {
+    std::string got = v.isNumber() ? "number" : "function";
+    typeError("boolean", got);
+}
+
+void checkFunction(const Value& v) {
+    if (!v.isFunction()) {
+        // Bonus: Type checking for function call?
+        // Spec says "Function call" Parameter Type "Any", Output "Depend...".
+        // But if it's not a function we can't call it.
+        typeError("function", v.isNumber() ? "number" : "boolean");
     }
 }
 
+void undefinedError(Symbol name) {
+    throw ProgramError{"Error: Variable " + symbols.name(name) + " not defined.", true, 1};
+}
+
+void redefineError(Symbol name) {
+    throw ProgramError{"Error: Redefining " + symbols.name(name) + " is not allowed.", true, 1};
+}
+
+void divisionByZeroError() {
+    // Division by zero behavior not specified, but assume crash or error
+    throw ProgramError{"Error: Division by zero", true, 1};
+}
+
+void arityError(size_t expected, size_t got) {
+    throw ProgramError{"Error: Need " + std::to_string(expected) + " arguments, but got " +
+                       std::to_string(got) + ".", true, 0}; // Match behavior of 01_1.lsp?
+}
+
+void recursionError() {
+    throw ProgramError{"Error: Recursion too deep", true, 1};
+}
+
+// --strict: operators evaluate every operand before checking any
+bool strictEval = false;
+
+namespace {
+
+Value evalHeld(Node* node, Environment* env, Value held) {
+    TempRoots roots;
+    roots.keep(held);
+    return node->eval(env);
+}
+
+// Evaluate `node` while `held`, an operand evaluated before it, stays
+// reachable; only a bignum needs to be a root for that
+inline Value evalKeeping(Node* node, Environment* env, Value held) {
+    return held.isBignum() ? evalHeld(node, env, held) : node->eval(env);
+}
+
+} // namespace
+
 // Implementations
 
 Value BinaryOpNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    if (strictEval) return evalStrict(env);
+
+    // Variadic operators fold each operand in as soon as it is evaluated;
+    // `=`, `and` and `or` stop evaluating once the result is known.
+    switch (op) {
+    case OpCode::ADD: {
+        Value sum(0);
+        for (Node* arg : args) {
+            Value v = evalKeeping(arg, env, sum);
+            checkNumber(v);
+            sum = numAdd(sum, v);
+        }
+        return sum;
+    }
+    case OpCode::MUL: {
+        Value prod(1);
+        for (Node* arg : args) {
+            Value v = evalKeeping(arg, env, prod);
+            checkNumber(v);
+            prod = numMul(prod, v);
+        }
+        return prod;
+    }
+    case OpCode::EQUAL: {
+        Value first = args[0]->eval(env);
+        checkNumber(first);
+        for (size_t i = 1; i < args.size(); ++i) {
+            Value v = evalKeeping(args[i], env, first);
+            checkNumber(v);
+            if (!numEqual(v, first)) return Value(false);
+        }
+        return Value(true);
+    }
+    case OpCode::AND:
+        for (Node* arg : args) {
+            Value v = arg->eval(env);
+            checkBool(v);
+            if (!v.boolean()) return Value(false);
+        }
+        return Value(true);
+    case OpCode::OR:
+        for (Node* arg : args) {
+            Value v = arg->eval(env);
+            checkBool(v);
+            if (v.boolean()) return Value(true);
+        }
+        return Value(false);
+    case OpCode::NOT: {
+        Value v = args[0]->eval(env);
+        checkBool(v);
+        return Value(!v.boolean());
+    }
+    default:
+        break;
+    }
+
+    // Fixed two-operand operators: both operands, then the checks, as before
+    Value a = args[0]->eval(env);
+    Value b = evalKeeping(args[1], env, a);
+    checkNumber(a);
+    checkNumber(b);
+    switch (op) {
+    case OpCode::SUB:
+        return numSub(a, b);
+    case OpCode::DIV:
+        if (numIsZero(b)) divisionByZeroError();
+        return numDiv(a, b);
+    case OpCode::MOD:
+        if (numIsZero(b)) divisionByZeroError();
+        return numMod(a, b);
+    case OpCode::GREATER:
+        return Value(numLess(b, a));
+    case OpCode::SMALLER:
+        return Value(numLess(a, b));
+    default:
+        return Value();
+    }
+}
+
+Value BinaryOpNode::evalStrict(Environment* env) {
     std::vector<Value> evaluatedArgs;
+    TempRoots held;
     for (Node* arg : args) {
         evaluatedArgs.push_back(arg->eval(env));
+        held.keep(evaluatedArgs.back());
     }
+    return combineOperands(op, evaluatedArgs.data(), evaluatedArgs.size());
+}
 
-    if (op == "+") {
-        int sum = 0;
-        for (const auto& v : evaluatedArgs) {
+Value BinaryOpNode::evalForked(Environment* env) {
+    std::vector<Value> values(args.size());
+    TempRoots held;
+    std::exception_ptr error;
+    // eval stops at the first operand of + or * that is not a number
+    bool folding = !strictEval && (op == OpCode::ADD || op == OpCode::MUL);
+    size_t evaluated = parallel.evalAll(args, env, values.data(), held, error, folding);
+    if (evaluated < args.size()) {
+        // Folding in the operands before the one that failed, as eval does,
+        // may meet a type error first; it does for one that is no number
+        if (folding) combineOperands(op, values.data(), evaluated);
+        std::rethrow_exception(error);
+    }
+    return combineOperands(op, values.data(), values.size());
+}
+
+Value combineOperands(OpCode op, const Value* values, size_t count) {
+    switch (op) {
+    case OpCode::ADD: {
+        Value sum(0);
+        if (sumOperands(values, count, sum)) return sum;
+        for (size_t i = 0; i < count; ++i) {
+            Value v = values[i];
             checkNumber(v);
-            sum += v.numVal;
+            sum = numAdd(sum, v);
         }
-        return Value(sum);
-    } else if (op == "-") {
-        checkNumber(evaluatedArgs[0]);
-        checkNumber(evaluatedArgs[1]);
-        return Value(evaluatedArgs[0].numVal - evaluatedArgs[1].numVal);
-    } else if (op == "*") {
-        int prod = 1;
-        for (const auto& v : evaluatedArgs) {
+        return sum;
+    }
+    case OpCode::SUB:
+        checkNumber(values[0]);
+        checkNumber(values[1]);
+        return numSub(values[0], values[1]);
+    case OpCode::MUL: {
+        Value prod(1);
+        for (size_t i = 0; i < count; ++i) {
+            Value v = values[i];
             checkNumber(v);
-            prod *= v.numVal;
-        }
-        return Value(prod);
-    } else if (op == "/") {
-        checkNumber(evaluatedArgs[0]);
-        checkNumber(evaluatedArgs[1]);
-        if (evaluatedArgs[1].numVal == 0) {
-            // Division by zero behavior not specified, but assume crash or error
-             std::cerr << "Error: Division by zero" << std::endl; exit(1);
+            prod = numMul(prod, v);
         }
-        return Value(evaluatedArgs[0].numVal / evaluatedArgs[1].numVal);
-    } else if (op == "mod") {
-        checkNumber(evaluatedArgs[0]);
-        checkNumber(evaluatedArgs[1]);
-        return Value(evaluatedArgs[0].numVal % evaluatedArgs[1].numVal);
-    } else if (op == ">") {
-        checkNumber(evaluatedArgs[0]);
-        checkNumber(evaluatedArgs[1]);
-        return Value(evaluatedArgs[0].numVal > evaluatedArgs[1].numVal);
-    } else if (op == "<") {
-        checkNumber(evaluatedArgs[0]);
-        checkNumber(evaluatedArgs[1]);
-        return Value(evaluatedArgs[0].numVal < evaluatedArgs[1].numVal);
-    } else if (op == "=") {
+        return prod;
+    }
+    case OpCode::DIV:
+        checkNumber(values[0]);
+        checkNumber(values[1]);
+        if (numIsZero(values[1])) divisionByZeroError();
+        return numDiv(values[0], values[1]);
+    case OpCode::MOD:
+        checkNumber(values[0]);
+        checkNumber(values[1]);
+        if (numIsZero(values[1])) divisionByZeroError();
+        return numMod(values[0], values[1]);
+    case OpCode::GREATER:
+        checkNumber(values[0]);
+        checkNumber(values[1]);
+        return Value(numLess(values[1], values[0]));
+    case OpCode::SMALLER:
+        checkNumber(values[0]);
+        checkNumber(values[1]);
+        return Value(numLess(values[0], values[1]));
+    case OpCode::EQUAL: {
         // "return #t if all EXPs are equal"
         // Can be numbers only based on spec table? 
         // Table says "Number(s)" for input.
         // Actually example (= (+ 1 1) 2 (/ 6 3)) => #t implies multiple args
-        if (evaluatedArgs.empty()) return Value(true);
-        checkNumber(evaluatedArgs[0]);
-        int first = evaluatedArgs[0].numVal;
-        for (size_t i = 1; i < evaluatedArgs.size(); ++i) {
-            checkNumber(evaluatedArgs[i]);
-            if (evaluatedArgs[i].numVal != first) return Value(false);
+        if (count == 0) return Value(true);
+        checkNumber(values[0]);
+        Value first = values[0];
+        if (first.isFixnum() && sameOperands(values, count, first)) return Value(true);
+        for (size_t i = 1; i < count; ++i) {
+            checkNumber(values[i]);
+            if (!numEqual(values[i], first)) return Value(false);
         }
         return Value(true);
-    } else if (op == "and") {
-        for (const auto& v : evaluatedArgs) {
+    }
+    case OpCode::AND:
+        if (sameOperands(values, count, Value(true))) return Value(true);
+        for (size_t i = 0; i < count; ++i) {
+            Value v = values[i];
             checkBool(v);
-            if (!v.boolVal) return Value(false);
+            if (!v.boolean()) return Value(false);
         }
         return Value(true);
-    } else if (op == "or") {
-        for (const auto& v : evaluatedArgs) {
+    case OpCode::OR:
+        if (sameOperands(values, count, Value(false))) return Value(false);
+        for (size_t i = 0; i < count; ++i) {
+            Value v = values[i];
             checkBool(v);
-            if (v.boolVal) return Value(true);
+            if (v.boolean()) return Value(true);
         }
         return Value(false);
-    } else if (op == "not") {
-        checkBool(evaluatedArgs[0]);
-        return Value(!evaluatedArgs[0].boolVal);
+    case OpCode::NOT:
+        checkBool(values[0]);
+        return Value(!values[0].boolean());
     }
     return Value();
 }
 
+NumberNode::~NumberNode() {
+    freeNumber(val);
+}
+
 Value IfNode::eval(Environment* env) {
     Value test = testExp->eval(env);
     checkBool(test);
-    if (test.boolVal) {
+    if (test.boolean()) {
+        return thenExp->eval(env);
+    } else {
+        return elseExp->eval(env);
+    }
+}
+
+Value IfNode::evalTail(Environment* env, TailCall& tail) {
+    Value test = testExp->eval(env);
+    checkBool(test);
+    if (test.boolean()) {
+        return thenExp->evalTail(env, tail);
+    } else {
+        return elseExp->evalTail(env, tail);
+    }
+}
+
+// Unchecked nodes of the Typer. With --strict, `=`, `and` and `or` still
+// evaluate every operand, since a later one may fail.
+
+Value AddIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value sum(0);
+    for (Node* arg : args) sum = numAdd(sum, evalKeeping(arg, env, sum));
+    return sum;
+}
+
+Value SubIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value a = args[0]->eval(env);
+    return numSub(a, evalKeeping(args[1], env, a));
+}
+
+Value MulIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value prod(1);
+    for (Node* arg : args) prod = numMul(prod, evalKeeping(arg, env, prod));
+    return prod;
+}
+
+Value DivIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value a = args[0]->eval(env);
+    Value b = evalKeeping(args[1], env, a);
+    if (numIsZero(b)) divisionByZeroError();
+    return numDiv(a, b);
+}
+
+Value ModIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value a = args[0]->eval(env);
+    Value b = evalKeeping(args[1], env, a);
+    if (numIsZero(b)) divisionByZeroError();
+    return numMod(a, b);
+}
+
+Value GreaterIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value a = args[0]->eval(env);
+    return Value(numLess(evalKeeping(args[1], env, a), a));
+}
+
+Value LessIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value a = args[0]->eval(env);
+    return Value(numLess(a, evalKeeping(args[1], env, a)));
+}
+
+Value EqualIntNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    Value first = args[0]->eval(env);
+    bool equal = true;
+    for (size_t i = 1; i < args.size() && (equal || strictEval); ++i) {
+        if (!numEqual(evalKeeping(args[i], env, first), first)) equal = false;
+    }
+    return Value(equal);
+}
+
+Value AndBoolNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    bool result = true;
+    for (size_t i = 0; i < args.size() && (result || strictEval); ++i) {
+        if (!args[i]->eval(env).boolean()) result = false;
+    }
+    return Value(result);
+}
+
+Value OrBoolNode::eval(Environment* env) {
+    if (fork && parallel.shouldFork()) return evalForked(env);
+    bool result = false;
+    for (size_t i = 0; i < args.size() && (!result || strictEval); ++i) {
+        if (args[i]->eval(env).boolean()) result = true;
+    }
+    return Value(result);
+}
+
+Value NotBoolNode::eval(Environment* env) {
+    return Value(!args[0]->eval(env).boolean());
+}
+
+Value IfBoolNode::eval(Environment* env) {
+    if (testExp->eval(env).boolean()) {
         return thenExp->eval(env);
     } else {
         return elseExp->eval(env);
     }
 }
 
+Value IfBoolNode::evalTail(Environment* env, TailCall& tail) {
+    if (testExp->eval(env).boolean()) {
+        return thenExp->evalTail(env, tail);
+    } else {
+        return elseExp->evalTail(env, tail);
+    }
+}
+
 Value PrintNode::eval(Environment* env) {
     Value v = exp->eval(env);
     if (isNum) {
         checkNumber(v);
-        std::cout << v.numVal << std::endl;
+        printNumber(runtime->out, v);
     } else {
         checkBool(v);
-        std::cout << (v.boolVal ? "#t" : "#f") << std::endl;
+        runtime->out.printBool(v.boolean());
     }
     return Value(); // Return nothing relevant
 }
@@ -133,11 +409,8 @@ Value DefineNode::eval(Environment* env) {
     // "Redefining is not allowed" - Basic feature check
     // Logic: check current env only? Or all? Spec: "Note: Redefining is not allowed."
     // We'll check current scope.
-    if (env->bindings.find(name) != env->bindings.end()) {
-        std::cerr << "Error: Redefining " << name << " is not allowed." << std::endl;
-        exit(1);
-    }
-    env->define(name, v);
+    if (!env->slots[slot].isNone()) redefineError(name);
+    env->slots[slot] = v;
     return Value();
 }
 
@@ -149,76 +422,147 @@ Value BlockNode::eval(Environment* env) {
     return last;
 }
 
+Value BlockNode::evalTail(Environment* env, TailCall& tail) {
+    // Only the last statement is in tail position
+    for (size_t i = 0; i + 1 < stmts.size(); ++i) {
+        stmts[i]->eval(env);
+    }
+    return stmts.back()->evalTail(env, tail);
+}
+
+FunNode::~FunNode() {
+    delete body;
+    for (VariableNode* var : captures) delete var;
+}
+
+Environment* FunNode::closureEnv(Environment* env) const {
+    if (capturesFrame) return env;
+    Environment* globals = env->ancestor(outerDepth);
+    if (captures.empty()) return globals;
+    return runtime->heap.newFrame(globals, int(captures.size()));
+}
+
 Value FunNode::eval(Environment* env) {
-    Value v;
-    v.type = ValType::FUNCTION;
     // Capture environment (Closure)
-    v.funcVal = new FuncData(params, body, env); 
-    return v;
+    Environment* captured = closureEnv(env);
+    // Every captured variable is defined by now (see Resolver)
+    for (size_t i = 0; i < captures.size(); ++i) {
+        if (int(i) != selfCapture) captured->slots[i] = captures[i]->eval(env);
+    }
+    FuncData* closure = runtime->heap.newClosure(this, captured);
+    if (selfCapture >= 0) captured->slots[selfCapture] = Value(closure);
+    return Value(closure);
 }
 
-Value CallNode::eval(Environment* env) {
-    Value func = funcExp->eval(env);
-    if (func.type != ValType::FUNCTION) {
-        // Bonus: Type checking for function call?
-        // Spec says "Function call" Parameter Type "Any", Output "Depend...".
-        // But if it's not a function we can't call it.
-        std::cout << "Type Error: Expect 'function' but got '" 
-                  << (func.type == ValType::NUMBER ? "number" : "boolean") << "'." << std::endl;
-        exit(0);
-    }
+Environment* CallNode::enter(Environment* env, FunNode*& fun) {
+    // Nothing is half-evaluated here, so the collector may run, and an
+    // operand no longer needed may stop
+    runtime->heap.safePoint();
+    if (parallel.enabled()) parallel.poll();
+    if (stackExhausted()) recursionError();
 
-    FuncData* fData = func.funcVal;
+    Environment* captured;
+    CallSite* cache = site >= 0 ? &runtime->callSites[site] : nullptr;
+    if (cache && cache->fun) {
+        // Checked by an earlier call, and a global cannot change
+        fun = cache->fun;
+        captured = cache->env;
+    } else {
+        Value func = funcExp->eval(env);
+        checkFunction(func);
 
-    // Check arg count
-    if (args.size() != fData->params.size()) {
-         std::cerr << "Error: Need " << fData->params.size() << " arguments, but got " << args.size() << "." << std::endl;
-         exit(0); // Match behavior of 01_1.lsp?
-    }
+        FuncData* fData = func.func();
 
-    // Evaluate arguments in CURRENT environment
-    std::vector<Value> argValues;
-    for (Node* arg : args) {
-        argValues.push_back(arg->eval(env));
+        // Check arg count
+        fun = fData->fun;
+        if (args.size() != fun->params.size()) arityError(fun->params.size(), args.size());
+        captured = fData->env;
+        if (cache) {
+            cache->fun = fun;
+            cache->env = captured;
+        }
     }
 
     // Create new environment for function execution
     // Parent should be the CAPTURED environment (Static Scope)
-    Environment* newEnv = new Environment(fData->env);
+    Environment* newEnv = fun->frameEscapes
+        ? runtime->heap.newFrame(captured, fun->frameSize)
+        : runtime->frames.push(captured, fun->frameSize);
+    runtime->heap.pushRoot(newEnv);
 
-    // Bind parameters
-    for (size_t i = 0; i < args.size(); ++i) {
-        newEnv->define(fData->params[i], argValues[i]);
+    // Evaluate arguments in CURRENT environment, straight into the
+    // parameter slots (they occupy the first slots of the frame)
+    if (fork && parallel.shouldFork()) {
+        parallel.evalInto(args, env, newEnv->slots);
+    } else {
+        for (size_t i = 0; i < args.size(); ++i) {
+            newEnv->slots[i] = args[i]->eval(env);
+        }
     }
+    return newEnv;
+}
+
+Value CallNode::eval(Environment* env) {
+    if (runtime->memo.enabled() || profiler.enabled()) return evalHooked(env);
+    FunNode* fun;
+    Environment* frame = enter(env, fun);
+    return run(fun, frame);
+}
 
+Value CallNode::run(FunNode* fun, Environment* frame) {
     // Execute body
     // "Variables used in FUN-BODY should be bound to PARAMs"
     // The parser stores BODY as an EXP.
-    return fData->body->eval(newEnv);
-}
-
-int main(int argc, char** argv) {
-    /* 
-       Wait, the user wants to run the interpreter on a file.
-       ./smli example.lsp
-       So we need to accept a filename.
-    */
-    if (argc > 1) {
-        FILE* file = fopen(argv[1], "r");
-        if (!file) {
-            std::cerr << "Could not open file " << argv[1] << std::endl;
-            return 1;
+    // Trampoline: a call in tail position of the body comes back as `tail`
+    // and takes over this frame instead of nesting another eval.
+    for (;;) {
+        TailCall tail;
+        Value result;
+        // A hot function runs as native code unless it deoptimizes (see jit.h)
+        if (!jit.enabled() || !jit.run(fun, frame, result)) result = fun->body->evalTail(frame, tail);
+        if (!tail.fun) {
+            runtime->heap.popRoot();
+            if (!fun->frameEscapes) {
+                runtime->frames.pop(frame);
+            }
+            return result;
         }
-        yyin = file;
-    }
-
-    yyparse(); // Builds 'program' vector
 
-    Environment* globalEnv = new Environment();
+        runtime->heap.popRoot();
+        if (!fun->frameEscapes) {
+            // Heap frames are left to the collector
+            frame = tail.fun->frameEscapes ? (runtime->frames.pop(frame), tail.frame)
+                                           : runtime->frames.replace(frame, tail.frame);
+        } else {
+            frame = tail.frame;
+        }
+        runtime->heap.replaceRoot(frame);
+        fun = tail.fun;
+        if (profiler.enabled()) profiler.tailCall(fun);
+    }
+}
 
-    for (Node* stmt : program) {
-        stmt->eval(globalEnv);
+Value CallNode::evalHooked(Environment* env) {
+    FunNode* fun;
+    Environment* frame = enter(env, fun);
+    Memo::Key key;
+    bool cached = runtime->memo.enabled() && runtime->memo.makeKey(fun, frame->parent, frame->slots, args.size(), key);
+    Value result;
+    if (cached && runtime->memo.lookup(key, result)) {
+        runtime->heap.popRoot();
+        if (!fun->frameEscapes) {
+            runtime->frames.pop(frame);
+        }
+        return result;
     }
+    if (profiler.enabled()) profiler.enter(fun);
+    result = run(fun, frame);
+    if (profiler.enabled()) profiler.leave();
+    if (cached) runtime->memo.store(key, result);
+    return result;
+}
 
-    return 0;
+Value CallNode::evalTail(Environment* env, TailCall& tail) {
+    tail.frame = enter(env, tail.fun);
+    return Value();
 }
@@ -0,0 +1,641 @@
+#include "jit.h"
+
+#include <cstddef>
+#include <cstring>
+#include "number.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+Jit jit;
+
+namespace {
+
+// Stack the native activations under one entry from the interpreter may
+// use; deeper recursion deoptimizes and goes on in the interpreter. Small
+// enough for the 1 MB main thread stack of Windows.
+const size_t STACK_BUDGET = 256 * 1024;
+
+enum Reg { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+           R8 = 8, R9 = 9, R12 = 12, R15 = 15 };
+
+// Condition codes of jcc and setcc
+enum Cond { CC_O = 0x0, CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD,
+            CC_LE = 0xE, CC_G = 0xF };
+
+// Opcodes of the two-register ALU instructions
+const uint8_t ADD = 0x01, SUB = 0x29, XOR = 0x31, CMP = 0x39, TEST = 0x85;
+
+// ModRM extensions of the immediate forms (0x83, 0x81) and shifts (0xC1)
+const int EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5, EXT_XOR = 6, EXT_CMP = 7;
+const int EXT_SHL = 4, EXT_SAR = 7;
+
+// The few x86-64 instructions the templates use, all 64-bit, with jumps to
+// labels that link() resolves once the code is complete
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void imm32(uint32_t v) { for (int i = 0; i < 4; ++i) byte(uint8_t(v >> (8 * i))); }
+    void imm64(uint64_t v) { for (int i = 0; i < 8; ++i) byte(uint8_t(v >> (8 * i))); }
+
+    void mov(Reg dst, Reg src) { rex(src, dst); byte(0x89); direct(src, dst); }
+    void movImm(Reg dst, uint64_t v) { rex(0, dst); byte(0xB8 | (dst & 7)); imm64(v); }
+    // dst = [base + disp]
+    void load(Reg dst, Reg base, int32_t disp) { rex(dst, base); byte(0x8B); indirect(dst, base, disp); }
+    // [base + disp] = src
+    void store(Reg base, int32_t disp, Reg src) { rex(src, base); byte(0x89); indirect(src, base, disp); }
+    void alu(uint8_t op, Reg dst, Reg src) { rex(src, dst); byte(op); direct(src, dst); }
+    void aluImm(int ext, Reg dst, int8_t v) { rex(0, dst); byte(0x83); direct(ext, dst); byte(uint8_t(v)); }
+    void aluImm32(int ext, Reg dst, int32_t v) { rex(0, dst); byte(0x81); direct(ext, dst); imm32(v); }
+    void shift(int ext, Reg dst, uint8_t count) { rex(0, dst); byte(0xC1); direct(ext, dst); byte(count); }
+    void imul(Reg dst, Reg src) { rex(dst, src); byte(0x0F); byte(0xAF); direct(dst, src); }
+    void cqo() { byte(0x48); byte(0x99); }
+    void idiv(Reg src) { rex(0, src); byte(0xF7); direct(7, src); }
+    void testRaxImm(int32_t v) { byte(0x48); byte(0xA9); imm32(v); }
+    void push(Reg r) { if (r >= 8) byte(0x41); byte(0x50 | (r & 7)); }
+    void pop(Reg r) { if (r >= 8) byte(0x41); byte(0x58 | (r & 7)); }
+    void call(Reg r) { if (r >= 8) byte(0x41); byte(0xFF); direct(2, r); }
+    void ret() { byte(0xC3); }
+
+    // rax = the boolean Value of condition `cc`
+    void setBool(Cond cc) {
+        byte(0x0F); byte(0x90 | cc); byte(0xC0); // setcc al
+        byte(0x0F); byte(0xB6); byte(0xC0);      // movzx eax, al
+        shift(EXT_SHL, RAX, 3);
+        aluImm(EXT_OR, RAX, Value::BOOLEAN_TAG);
+    }
+
+    int label() {
+        labels.push_back(-1);
+        return int(labels.size()) - 1;
+    }
+    void bind(int label) { labels[label] = ptrdiff_t(code.size()); }
+    void jump(int label) { byte(0xE9); fixup(label); }
+    void jumpIf(Cond cc, int label) { byte(0x0F); byte(0x80 | cc); fixup(label); }
+
+    void link() {
+        for (const Fixup& f : fixups) {
+            int32_t rel = int32_t(labels[f.label] - ptrdiff_t(f.at + 4));
+            std::memcpy(&code[f.at], &rel, 4);
+        }
+        fixups.clear();
+    }
+
+private:
+    struct Fixup {
+        size_t at;
+        int label;
+    };
+
+    std::vector<ptrdiff_t> labels;
+    std::vector<Fixup> fixups;
+
+    // REX.W with the high bits of the ModRM reg and rm fields
+    void rex(int reg, int rm) { byte(0x48 | (reg >> 3) << 2 | (rm >> 3)); }
+    void direct(int reg, int rm) { byte(0xC0 | (reg & 7) << 3 | (rm & 7)); }
+    void indirect(int reg, int base, int32_t disp) {
+        byte(0x80 | (reg & 7) << 3 | (base & 7));
+        if ((base & 7) == RSP) byte(0x24); // SIB: no index
+        imm32(uint32_t(disp));
+    }
+
+    void fixup(int label) {
+        fixups.push_back(Fixup{code.size(), label});
+        imm32(0);
+    }
+};
+
+// What an expression leaves in rax, as far as the code knows
+enum Kind { ANY, FIXNUM, BOOLEAN };
+
+// The function value of the global a call names, as plan() found it
+FuncData* callee(CallNode* call, Environment* globals) {
+    return globals->slots[static_cast<VariableNode*>(call->funcExp)->slot].func();
+}
+
+// Whether the templates cover `node`, adding the global functions it calls
+// to `callees`
+bool compilable(Node* node, FunNode* fun, Environment* globals, std::vector<FunNode*>& callees) {
+    if (auto num = dynamic_cast<NumberNode*>(node)) {
+        return num->val.isFixnum();
+    } else if (dynamic_cast<BoolNode*>(node)) {
+        return true;
+    } else if (auto var = dynamic_cast<VariableNode*>(node)) {
+        return var->depth > 0 || size_t(var->slot) < fun->params.size();
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        if (op->args.empty()) return false;
+        for (Node* arg : op->args) {
+            if (!compilable(arg, fun, globals, callees)) return false;
+        }
+        return true;
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        return compilable(ifn->testExp, fun, globals, callees) &&
+               compilable(ifn->thenExp, fun, globals, callees) &&
+               compilable(ifn->elseExp, fun, globals, callees);
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        if (call->site < 0) return false;
+        Value target = globals->slots[static_cast<VariableNode*>(call->funcExp)->slot];
+        if (!target.isFunction() || target.func()->fun->params.size() != call->args.size()) return false;
+        callees.push_back(target.func()->fun);
+        for (Node* arg : call->args) {
+            if (!compilable(arg, fun, globals, callees)) return false;
+        }
+        return true;
+    }
+    // Lambdas, local defines
+    return false;
+}
+
+// Native code of one function. Its arguments are an array at rdi and its
+// closure environment is rsi, which it keeps in rbx and r12 (preserved, as
+// are rbp and r15, the stack limit); it returns the Value in rax, 0 to
+// deoptimize. Temporaries are pushed, so calls made with a pending operand
+// find its value on the stack when they return.
+class Emitter {
+public:
+    Emitter(Assembler& a, Environment* globals) : a(a), globals(globals) {}
+
+    void function(FunNode* f) {
+        fun = f;
+        top = a.label();
+        deopt = a.label();
+        int done = a.label();
+        a.push(RBP);
+        a.mov(RBP, RSP);
+        a.push(RBX);
+        a.push(R12);
+        a.alu(CMP, RSP, R15);
+        a.jumpIf(CC_B, deopt);
+        a.mov(RBX, RDI);
+        a.mov(R12, RSI);
+        a.bind(top);
+        expr(fun->body, true);
+        a.bind(done);
+        a.byte(0x48); a.byte(0x8D); a.byte(0x65); a.byte(0xF0); // lea rsp, [rbp - 16]
+        a.pop(R12);
+        a.pop(RBX);
+        a.pop(RBP);
+        a.ret();
+        // Whatever is pushed is dropped with the frame
+        a.bind(deopt);
+        a.alu(XOR, RAX, RAX);
+        a.jump(done);
+    }
+
+private:
+    Assembler& a;
+    Environment* globals;
+    FunNode* fun = nullptr;
+    int top = -1;   // After the prologue, where a self tail call goes
+    int deopt = -1;
+
+    Kind expr(Node* node, bool tail) {
+        if (auto num = dynamic_cast<NumberNode*>(node)) {
+            a.movImm(RAX, num->val.bits);
+            return FIXNUM;
+        } else if (auto b = dynamic_cast<BoolNode*>(node)) {
+            a.movImm(RAX, Value(b->val).bits);
+            return BOOLEAN;
+        } else if (auto var = dynamic_cast<VariableNode*>(node)) {
+            variable(var, RAX);
+            return ANY;
+        } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+            return binary(op);
+        } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+            int otherwise = a.label(), end = a.label();
+            branch(ifn->testExp, otherwise);
+            Kind then = expr(ifn->thenExp, tail);
+            a.jump(end);
+            a.bind(otherwise);
+            Kind other = expr(ifn->elseExp, tail);
+            a.bind(end);
+            return then == other ? then : ANY;
+        }
+        return call(static_cast<CallNode*>(node), tail);
+    }
+
+    void variable(VariableNode* var, Reg r) {
+        if (var->depth == 0) {
+            // An argument, always defined
+            a.load(r, RBX, 8 * var->slot);
+            return;
+        }
+        a.mov(r, R12);
+        for (int i = 1; i < var->depth; ++i) a.load(r, r, int32_t(offsetof(Environment, parent)));
+        a.load(r, r, int32_t(offsetof(Environment, slots)));
+        a.load(r, r, 8 * var->slot);
+        a.alu(TEST, r, r);
+        a.jumpIf(CC_E, deopt);
+    }
+
+    void guardTag(Kind kind, Kind want, Reg r) {
+        if (kind == want) return;
+        a.mov(RDX, r);
+        a.aluImm(EXT_AND, RDX, Value::TAG_MASK);
+        a.aluImm(EXT_CMP, RDX, want == FIXNUM ? Value::NUMBER_TAG : Value::BOOLEAN_TAG);
+        a.jumpIf(CC_NE, deopt);
+    }
+
+    // Operand `node` as a fixnum in rcx, keeping rax
+    void fixnumOperand(Node* node) {
+        auto num = dynamic_cast<NumberNode*>(node);
+        auto var = dynamic_cast<VariableNode*>(node);
+        if (num) {
+            a.movImm(RCX, num->val.bits);
+        } else if (var && var->depth == 0) {
+            variable(var, RCX);
+            guardTag(ANY, FIXNUM, RCX);
+        } else {
+            a.push(RAX);
+            guardTag(expr(node, false), FIXNUM, RAX);
+            a.mov(RCX, RAX);
+            a.pop(RAX);
+        }
+    }
+
+    // rax op= rcx on two fixnums
+    void arithmetic(OpCode op) {
+        switch (op) {
+        case OpCode::ADD:
+        case OpCode::SUB:
+            a.aluImm(EXT_SUB, RCX, Value::NUMBER_TAG);
+            a.alu(op == OpCode::ADD ? ADD : SUB, RAX, RCX);
+            a.jumpIf(CC_O, deopt);
+            break;
+        case OpCode::MUL:
+            a.shift(EXT_SAR, RAX, 3);
+            a.aluImm(EXT_SUB, RCX, Value::NUMBER_TAG);
+            a.imul(RAX, RCX);
+            a.jumpIf(CC_O, deopt);
+            a.aluImm(EXT_OR, RAX, Value::NUMBER_TAG);
+            break;
+        case OpCode::DIV:
+        case OpCode::MOD: {
+            a.shift(EXT_SAR, RAX, 3);
+            a.shift(EXT_SAR, RCX, 3);
+            // The interpreter reports a zero divisor
+            a.alu(TEST, RCX, RCX);
+            a.jumpIf(CC_E, deopt);
+            if (op == OpCode::DIV) {
+                // FIXNUM_MIN / -1 leaves the range
+                int fits = a.label();
+                a.aluImm(EXT_CMP, RCX, -1);
+                a.jumpIf(CC_NE, fits);
+                a.movImm(RDX, uint64_t(Value::FIXNUM_MIN));
+                a.alu(CMP, RAX, RDX);
+                a.jumpIf(CC_E, deopt);
+                a.bind(fits);
+            }
+            a.cqo();
+            a.idiv(RCX);
+            if (op == OpCode::MOD) a.mov(RAX, RDX);
+            a.shift(EXT_SHL, RAX, 3);
+            a.aluImm(EXT_OR, RAX, Value::NUMBER_TAG);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    Kind binary(BinaryOpNode* op) {
+        const std::vector<Node*>& args = op->args;
+        switch (op->op) {
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+        case OpCode::DIV:
+        case OpCode::MOD:
+            guardTag(expr(args[0], false), FIXNUM, RAX);
+            for (size_t i = 1; i < args.size(); ++i) {
+                fixnumOperand(args[i]);
+                arithmetic(op->op);
+            }
+            return FIXNUM;
+        case OpCode::GREATER:
+        case OpCode::SMALLER:
+            guardTag(expr(args[0], false), FIXNUM, RAX);
+            fixnumOperand(args[1]);
+            a.alu(CMP, RAX, RCX);
+            a.setBool(op->op == OpCode::GREATER ? CC_G : CC_L);
+            return BOOLEAN;
+        case OpCode::EQUAL:
+            return equal(args);
+        case OpCode::AND:
+        case OpCode::OR:
+            return logical(args, op->op == OpCode::AND);
+        case OpCode::NOT:
+            guardTag(expr(args[0], false), BOOLEAN, RAX);
+            a.aluImm(EXT_XOR, RAX, 8);
+            return BOOLEAN;
+        }
+        return ANY;
+    }
+
+    // Each operand against the first, which stays on the stack. --strict
+    // evaluates them all, keeping the result so far below the first.
+    Kind equal(const std::vector<Node*>& args) {
+        if (strictEval) {
+            a.movImm(RAX, Value(true).bits);
+            a.push(RAX);
+        }
+        guardTag(expr(args[0], false), FIXNUM, RAX);
+        a.push(RAX);
+        int differ = a.label(), end = a.label();
+        for (size_t i = 1; i < args.size(); ++i) {
+            guardTag(expr(args[i], false), FIXNUM, RAX);
+            a.load(RCX, RSP, 0);
+            a.alu(CMP, RAX, RCX);
+            if (strictEval) {
+                int same = a.label();
+                a.jumpIf(CC_E, same);
+                a.movImm(RCX, Value(false).bits);
+                a.store(RSP, 8, RCX);
+                a.bind(same);
+            } else {
+                a.jumpIf(CC_NE, differ);
+            }
+        }
+        if (strictEval) {
+            a.aluImm(EXT_ADD, RSP, 8);
+            a.pop(RAX);
+            return BOOLEAN;
+        }
+        a.movImm(RAX, Value(true).bits);
+        a.jump(end);
+        a.bind(differ);
+        a.movImm(RAX, Value(false).bits);
+        a.bind(end);
+        a.aluImm(EXT_ADD, RSP, 8);
+        return BOOLEAN;
+    }
+
+    // `and` stops at the first #f and `or` at the first #t, unless --strict
+    Kind logical(const std::vector<Node*>& args, bool isAnd) {
+        Value decided(!isAnd);
+        if (strictEval) {
+            a.movImm(RAX, Value(isAnd).bits);
+            a.push(RAX);
+        }
+        int stop = a.label(), end = a.label();
+        for (Node* arg : args) {
+            guardTag(expr(arg, false), BOOLEAN, RAX);
+            a.testRaxImm(8);
+            if (strictEval) {
+                int next = a.label();
+                a.jumpIf(isAnd ? CC_NE : CC_E, next);
+                a.movImm(RCX, decided.bits);
+                a.store(RSP, 0, RCX);
+                a.bind(next);
+            } else {
+                a.jumpIf(isAnd ? CC_E : CC_NE, stop);
+            }
+        }
+        if (strictEval) {
+            a.pop(RAX);
+            return BOOLEAN;
+        }
+        a.movImm(RAX, Value(isAnd).bits);
+        a.jump(end);
+        a.bind(stop);
+        a.movImm(RAX, decided.bits);
+        a.bind(end);
+        return BOOLEAN;
+    }
+
+    // Jump to `otherwise` when `test` is #f; a comparison of two operands
+    // branches on the flags
+    void branch(Node* test, int otherwise) {
+        auto op = dynamic_cast<BinaryOpNode*>(test);
+        if (op && op->args.size() == 2 &&
+            (op->op == OpCode::GREATER || op->op == OpCode::SMALLER || op->op == OpCode::EQUAL)) {
+            guardTag(expr(op->args[0], false), FIXNUM, RAX);
+            fixnumOperand(op->args[1]);
+            a.alu(CMP, RAX, RCX);
+            a.jumpIf(op->op == OpCode::GREATER ? CC_LE : op->op == OpCode::SMALLER ? CC_GE : CC_NE, otherwise);
+            return;
+        }
+        guardTag(expr(test, false), BOOLEAN, RAX);
+        a.testRaxImm(8);
+        a.jumpIf(CC_E, otherwise);
+    }
+
+    // The closure is checked and pushed first, then the arguments are laid
+    // out above it in order, which makes them the callee's array
+    Kind call(CallNode* call, bool tail) {
+        FunNode* target = callee(call, globals)->fun;
+        int32_t area = int32_t(8 * call->args.size());
+        variable(static_cast<VariableNode*>(call->funcExp), RAX);
+        a.mov(RDX, RAX);
+        a.aluImm(EXT_AND, RDX, Value::TAG_MASK);
+        a.jumpIf(CC_NE, deopt);
+        a.load(RDX, RAX, int32_t(offsetof(FuncData, fun)));
+        a.movImm(RCX, uint64_t(uintptr_t(target)));
+        a.alu(CMP, RDX, RCX);
+        a.jumpIf(CC_NE, deopt);
+        a.push(RAX);
+        if (area) a.aluImm32(EXT_SUB, RSP, area);
+        for (size_t i = 0; i < call->args.size(); ++i) {
+            expr(call->args[i], false);
+            a.store(RSP, int32_t(8 * i), RAX);
+        }
+        a.load(RAX, RSP, area);
+        a.load(RSI, RAX, int32_t(offsetof(FuncData, env)));
+
+        if (tail && target == fun) {
+            // The interpreter would resume in the frame it made, whose
+            // parent is the closure environment this activation started with
+            a.alu(CMP, RSI, R12);
+            a.jumpIf(CC_NE, deopt);
+            for (size_t i = 0; i < call->args.size(); ++i) {
+                a.load(RAX, RSP, int32_t(8 * i));
+                a.store(RBX, int32_t(8 * i), RAX);
+            }
+            a.aluImm32(EXT_ADD, RSP, area + 8);
+            a.jump(top);
+            return ANY;
+        }
+
+        a.mov(RDI, RSP);
+        // Through the FunNode, which has no code yet when it is compiled
+        // after this one, and none again once it gives up on native code
+        a.movImm(RAX, uint64_t(uintptr_t(&target->native)));
+        a.load(RAX, RAX, 0);
+        a.alu(TEST, RAX, RAX);
+        a.jumpIf(CC_E, deopt);
+        a.call(RAX);
+        a.aluImm32(EXT_ADD, RSP, area + 8);
+        a.alu(TEST, RAX, RAX);
+        a.jumpIf(CC_E, deopt);
+        return ANY;
+    }
+};
+
+// Called by the interpreter as uint64_t(Value* args, Environment* env,
+// void* code, char* stackLimit): saves what the native code treats as
+// preserved and sets up r15
+std::vector<uint8_t> trampolineCode() {
+    Assembler a;
+    a.push(RBP);
+    a.mov(RBP, RSP);
+    a.push(RBX);
+    a.push(R12);
+    a.push(R15);
+#ifdef _WIN32
+    // Arguments in rcx, rdx, r8 and r9, and rdi and rsi are preserved
+    a.push(RDI);
+    a.push(RSI);
+    a.mov(RDI, RCX);
+    a.mov(RSI, RDX);
+    a.mov(R15, R9);
+    a.call(R8);
+    a.pop(RSI);
+    a.pop(RDI);
+#else
+    a.mov(R15, RCX);
+    a.call(RDX);
+#endif
+    a.pop(R15);
+    a.pop(R12);
+    a.pop(RBX);
+    a.pop(RBP);
+    a.ret();
+    return a.code;
+}
+
+typedef uint64_t (*Trampoline)(Value* args, Environment* env, void* code, char* stackLimit);
+
+} // namespace
+
+Jit::~Jit() {
+    for (const auto& block : blocks) {
+#ifdef _WIN32
+        VirtualFree(block.first, 0, MEM_RELEASE);
+#else
+        munmap(block.first, block.second);
+#endif
+    }
+}
+
+bool Jit::supported() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Jit::enter(FunNode* fun, Environment* frame, Value& result) {
+    if (!fun->native) {
+        compile(fun, frame->ancestor(fun->globalDepth()));
+        if (!fun->native) return false;
+    }
+    char* limit = static_cast<char*>(__builtin_frame_address(0)) - STACK_BUDGET;
+    counters.nativeCalls++;
+    uint64_t bits = reinterpret_cast<Trampoline>(trampoline)(frame->slots, frame->parent, fun->native, limit);
+    if (bits) {
+        result.bits = bits;
+        return true;
+    }
+    counters.deopts++;
+    if (++fun->jitDeopts >= MAX_DEOPTS) {
+        fun->native = nullptr;
+        fun->jitState = FAILED;
+    }
+    return false;
+}
+
+bool Jit::plan(FunNode* fun, Environment* globals, std::vector<FunNode*>& group) {
+    // One already in the group, or compiled before, is called through its FunNode
+    if (fun->jitState == NATIVE || fun->jitState == COMPILING) return true;
+    if (fun->jitState == FAILED) return false;
+    std::vector<FunNode*> callees;
+    if (!compilable(fun->body, fun, globals, callees)) {
+        fun->jitState = FAILED;
+        return false;
+    }
+    fun->jitState = COMPILING;
+    group.push_back(fun);
+    for (FunNode* callee : callees) {
+        if (!plan(callee, globals, group)) {
+            fun->jitState = FAILED;
+            return false;
+        }
+    }
+    return true;
+}
+
+void Jit::compile(FunNode* fun, Environment* globals) {
+    std::vector<FunNode*> group;
+    bool ok = plan(fun, globals, group);
+    if (ok && !trampoline) {
+        trampoline = install(trampolineCode());
+        ok = trampoline != nullptr;
+    }
+    std::vector<size_t> entries;
+    Assembler a;
+    if (ok) {
+        for (FunNode* f : group) {
+            entries.push_back(a.code.size());
+            Emitter(a, globals).function(f);
+        }
+        a.link();
+    }
+    uint8_t* base = ok ? static_cast<uint8_t*>(install(a.code)) : nullptr;
+    if (!base) {
+        counters.rejected++;
+        fun->jitState = FAILED;
+        // The others may still make it on their own once they are hot
+        for (FunNode* f : group) {
+            if (f->jitState == COMPILING) {
+                f->jitState = COLD;
+                f->jitCalls = 0;
+            }
+        }
+        return;
+    }
+    for (size_t i = 0; i < group.size(); ++i) {
+        group[i]->native = base + entries[i];
+        group[i]->jitState = NATIVE;
+    }
+    counters.compiled += group.size();
+}
+
+void* Jit::install(const std::vector<uint8_t>& code) {
+    size_t size = code.size();
+#ifdef _WIN32
+    void* mem = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!mem) return nullptr;
+    std::memcpy(mem, code.data(), size);
+    DWORD old;
+    if (!VirtualProtect(mem, size, PAGE_EXECUTE_READ, &old)) {
+        VirtualFree(mem, 0, MEM_RELEASE);
+        return nullptr;
+    }
+#else
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return nullptr;
+    std::memcpy(mem, code.data(), size);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return nullptr;
+    }
+#endif
+    blocks.push_back(std::make_pair(mem, size));
+    counters.codeBytes += size;
+    return mem;
+}
+
+void Jit::printStats(std::ostream& os) const {
+    os << "JIT statistics:" << std::endl
+       << "  functions compiled: " << counters.compiled << std::endl
+       << "  hot, not compiled:  " << counters.rejected << std::endl
+       << "  code bytes:         " << counters.codeBytes << std::endl
+       << "  native calls:       " << counters.nativeCalls << std::endl
+       << "  deoptimizations:    " << counters.deopts << std::endl;
+}
@@ -0,0 +1,89 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "ast.h"
+
+// Template JIT for --jit (tree walker only). The interpreter counts the
+// calls of every function, and a function reaching HOT_CALLS has its body
+// compiled to x86-64 machine code, along with the global functions it
+// calls. Each node becomes a fixed instruction sequence, with the values in
+// their tagged form: fixnum arithmetic works on the words as number.h does,
+// and a comparison feeding an `if` branches directly.
+//
+// The code speculates on what the interpreter saw so far: every operand of
+// an operator is a fixnum or a boolean, nothing overflows or divides by
+// zero, and a global that was a function still holds a closure of the same
+// one. A guard checks each assumption, and one that fails deoptimizes: the
+// native activations return at once and the interpreter runs the call
+// again from the start in the same frame. Calls have no side effects (the
+// grammar keeps prints out of function bodies), so running part of one
+// twice cannot be observed, and every error is left to the interpreter to
+// report. A self call in tail position overwrites the arguments and jumps
+// back to the start, so the interpreter resumes from there if it has to.
+// A function that keeps deoptimizing goes back to the interpreter for good.
+//
+// Bodies with local defines or lambdas, bignum literals, and calls of
+// anything but a global function are not compiled, nor are the functions
+// that call them. Native code never allocates or reaches a safe point, so
+// the collector does not need to know about it.
+//
+// Process-wide like --profile: the counters and the code live on the
+// FunNodes, so only one thread may run programs with it on.
+class Jit {
+public:
+    static const unsigned HOT_CALLS = 1000;
+    static const int MAX_DEOPTS = 3;
+
+    // FunNode::jitState
+    enum State { COLD, COMPILING, NATIVE, FAILED };
+
+    struct Stats {
+        size_t compiled = 0;    // Functions turned into native code
+        size_t rejected = 0;    // Hot functions that could not be
+        size_t codeBytes = 0;
+        size_t nativeCalls = 0; // Calls the interpreter handed to native code
+        size_t deopts = 0;
+    };
+
+    Jit() = default;
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Whether this build can generate code for the machine
+    static bool supported();
+
+    void start() { on = true; }
+    bool enabled() const { return on; }
+
+    // Run the body of `fun` in `frame`, with its arguments bound, as native
+    // code. False when the interpreter has to: the function is not hot yet,
+    // cannot be compiled, or deoptimized.
+    bool run(FunNode* fun, Environment* frame, Value& result) {
+        if (!fun->native && (fun->jitState != COLD || ++fun->jitCalls < HOT_CALLS)) return false;
+        return enter(fun, frame, result);
+    }
+
+    const Stats& stats() const { return counters; }
+    void printStats(std::ostream& os) const;
+
+private:
+    bool on = false;
+    Stats counters;
+    std::vector<std::pair<void*, size_t>> blocks; // Executable memory
+    void* trampoline = nullptr;
+
+    bool enter(FunNode* fun, Environment* frame, Value& result);
+    void compile(FunNode* fun, Environment* globals);
+    // Add `fun` and the functions it calls to `group`, if they can all be compiled
+    bool plan(FunNode* fun, Environment* globals, std::vector<FunNode*>& group);
+    void* install(const std::vector<uint8_t>& code);
+};
+
+extern Jit jit;
+
+#endif
@@ -0,0 +1,133 @@
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define KERNELS_NEON 1
+#endif
+
+namespace {
+
+// A tagged fixnum of [-2^50, 2^50) is a word of [-2^53, 2^53) with tag 1,
+// so `(word + 2^53) >> 54` is 0 for it, as is `(word & 7) ^ 1`. Words of
+// up to SUM_BLOCK such numbers add up without overflow, to 8 times
+// the sum of the numbers plus one tag per word.
+const uint64_t RANGE_BIAS = uint64_t(1) << 53;
+
+int64_t untag(uint64_t sum, size_t n) {
+    return int64_t(sum - n) >> 3;
+}
+
+bool sumBlockScalar(const Value* v, size_t n, int64_t& sum) {
+    uint64_t total = 0, bad = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t w = v[i].bits;
+        bad |= ((w & Value::TAG_MASK) ^ Value::NUMBER_TAG) | ((w + RANGE_BIAS) >> 54);
+        total += w;
+    }
+    sum = untag(total, n);
+    return bad == 0;
+}
+
+bool allEqualScalar(const Value* v, size_t n, uint64_t bits) {
+    for (size_t i = 0; i < n; ++i) {
+        if (v[i].bits != bits) return false;
+    }
+    return true;
+}
+
+#ifdef KERNELS_AVX2
+
+__attribute__((target("avx2"))) bool sumBlockAvx2(const Value* v, size_t n, int64_t& sum) {
+    const __m256i tagMask = _mm256_set1_epi64x(Value::TAG_MASK);
+    const __m256i tag = _mm256_set1_epi64x(Value::NUMBER_TAG);
+    const __m256i bias = _mm256_set1_epi64x(int64_t(RANGE_BIAS));
+    __m256i total = _mm256_setzero_si256(), bad = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+        bad = _mm256_or_si256(bad, _mm256_xor_si256(_mm256_and_si256(w, tagMask), tag));
+        bad = _mm256_or_si256(bad, _mm256_srli_epi64(_mm256_add_epi64(w, bias), 54));
+        total = _mm256_add_epi64(total, w);
+    }
+    int64_t tail;
+    bool ok = sumBlockScalar(v + i, n - i, tail) && _mm256_testz_si256(bad, bad);
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+    sum = untag(lanes[0] + lanes[1] + lanes[2] + lanes[3], i) + tail;
+    return ok;
+}
+
+__attribute__((target("avx2"))) bool allEqualAvx2(const Value* v, size_t n, uint64_t bits) {
+    const __m256i expected = _mm256_set1_epi64x(int64_t(bits));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(w, expected)) != -1) return false;
+    }
+    return allEqualScalar(v + i, n - i, bits);
+}
+
+#endif
+
+#ifdef KERNELS_NEON
+
+bool sumBlockNeon(const Value* v, size_t n, int64_t& sum) {
+    const uint64x2_t tagMask = vdupq_n_u64(Value::TAG_MASK);
+    const uint64x2_t tag = vdupq_n_u64(Value::NUMBER_TAG);
+    const uint64x2_t bias = vdupq_n_u64(RANGE_BIAS);
+    uint64x2_t total = vdupq_n_u64(0), bad = vdupq_n_u64(0);
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(v);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        uint64x2_t w = vld1q_u64(words + i);
+        bad = vorrq_u64(bad, veorq_u64(vandq_u64(w, tagMask), tag));
+        bad = vorrq_u64(bad, vshrq_n_u64(vaddq_u64(w, bias), 54));
+        total = vaddq_u64(total, w);
+    }
+    int64_t tail;
+    bool ok = sumBlockScalar(v + i, n - i, tail) && (vgetq_lane_u64(bad, 0) | vgetq_lane_u64(bad, 1)) == 0;
+    sum = untag(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1), i) + tail;
+    return ok;
+}
+
+bool allEqualNeon(const Value* v, size_t n, uint64_t bits) {
+    const uint64x2_t expected = vdupq_n_u64(bits);
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(v);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        uint64x2_t same = vceqq_u64(vld1q_u64(words + i), expected);
+        if ((vgetq_lane_u64(same, 0) & vgetq_lane_u64(same, 1)) != ~uint64_t(0)) return false;
+    }
+    return allEqualScalar(v + i, n - i, bits);
+}
+
+#endif
+
+Kernels pick() {
+#if defined(KERNELS_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Kernels{sumBlockAvx2, allEqualAvx2};
+#elif defined(KERNELS_NEON)
+    return Kernels{sumBlockNeon, allEqualNeon};
+#endif
+    return Kernels{sumBlockScalar, allEqualScalar};
+}
+
+} // namespace
+
+const Kernels kernels = pick();
+
+bool wideSum(const Value* v, size_t n, Value& result) {
+    int64_t total = 0;
+    for (size_t i = 0; i < n; i += SUM_BLOCK) {
+        size_t block = n - i < SUM_BLOCK ? n - i : SUM_BLOCK;
+        int64_t sum;
+        if (!kernels.sumBlock(v + i, block, sum) || __builtin_add_overflow(total, sum, &total)) return false;
+    }
+    if (total < Value::FIXNUM_MIN || total > Value::FIXNUM_MAX) return false;
+    result = Value::fixnum(total);
+    return true;
+}
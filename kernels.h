@@ -0,0 +1,46 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "ast.h"
+
+// Vector kernels for the operand lists of wide variadic operators, which
+// the VM keeps side by side on its operand stack and --strict collects in
+// a vector. They only answer the common case, every operand a fixnum or
+// every one the same word, and leave anything else (and short lists, where
+// the setup does not pay off) to the checked scalar loop of the caller,
+// which then reports errors in the usual order.
+//
+// AVX2 is used when the CPU has it, chosen once at startup, NEON on
+// AArch64, where it is always there, and a scalar loop everywhere else.
+const size_t WIDE_OPERANDS = 16;
+
+// Longest list one sumBlock call takes
+const size_t SUM_BLOCK = 512;
+
+struct Kernels {
+    // Whether all `n` words are fixnums in [-2^50, 2^50), and then their
+    // sum in `sum`; `n` is at most SUM_BLOCK, so the sum cannot overflow
+    bool (*sumBlock)(const Value* v, size_t n, int64_t& sum);
+    // Whether all `n` words are `bits`
+    bool (*allEqual)(const Value* v, size_t n, uint64_t bits);
+};
+
+extern const Kernels kernels;
+
+// The sum of `n` fixnums, when they are and it is a fixnum too
+bool wideSum(const Value* v, size_t n, Value& result);
+
+// `+` of a wide operand list, when the kernel can answer it
+inline bool sumOperands(const Value* v, size_t n, Value& result) {
+    return n >= WIDE_OPERANDS && wideSum(v, n, result);
+}
+
+// Whether a wide operand list is all the same word as `first`: all equal
+// for `=` of fixnums, all #t for `and`, all #f for `or`
+inline bool sameOperands(const Value* v, size_t n, Value first) {
+    return n >= WIDE_OPERANDS && kernels.allEqual(v, n, first.bits);
+}
+
+#endif
@@ -0,0 +1,532 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "ast.h"
+#include "resolver.h"
+#include "optimizer.h"
+#include "heap.h"
+#include "vm.h"
+#include "bench.h"
+#include "bench_alloc.h"
+#include "memo.h"
+#include "profile.h"
+#include "parse.h"
+#include "source.h"
+#include "runtime.h"
+#include "pool.h"
+#include "parallel.h"
+#include "jit.h"
+#include "minilisp.h"
+#include "server.h"
+#include "stats.h"
+
+// Runtime of the command line program. Static, so that it outlives the
+// statistics printed on exit.
+static Runtime mainRuntime(std::cout, std::cerr);
+
+static void printHeapStats() {
+    runtime->heap.printStats(std::cerr);
+}
+
+static void printMemoStats() {
+    runtime->memo.printStats(std::cerr);
+}
+
+static void printJitStats() {
+    jit.printStats(std::cerr);
+}
+
+static const char* statsPath = nullptr;
+
+static void printStats() {
+    if (*statsPath) {
+        std::ofstream file(statsPath);
+        stats.print(file);
+    } else {
+        stats.print(std::cerr);
+    }
+}
+
+static void printProfile() {
+    profiler.finish(std::cerr);
+}
+
+static void printBench() {
+    bench.stop();
+    bench.print(std::cerr);
+}
+
+// --stream: every top-level statement is resolved, folded and run as soon
+// as the parser completes it. The global frame grows as new names appear;
+// its slots live outside the frame so that closures keep pointing to it.
+// A statement is freed after running unless it contains a FunNode, since a
+// closure made from it may outlive it. Those statements are kept until a
+// collection finds no closure of any of their functions.
+namespace {
+struct Stream {
+    Resolver resolver;
+    Optimizer optimizer;
+    bool fold = true;
+    VM* vm = nullptr;
+    Environment* globals = nullptr;
+    std::vector<Value> globalSlots;
+    std::vector<Node*> retained;
+    size_t pruneAt = 64;
+};
+}
+
+static Stream* stream = nullptr;
+
+static void growGlobals(int count) {
+    Environment* globals = stream->globals;
+    if (count <= globals->size) return;
+    if (size_t(count) > stream->globalSlots.size()) {
+        stream->globalSlots.resize(std::max<size_t>(count, stream->globalSlots.size() * 2));
+    }
+    globals->slots = stream->globalSlots.data();
+    globals->size = count;
+}
+
+// Whether a closure of a FunNode in `node` was reached by the last collection
+static bool reachedByCollection(Node* node) {
+    if (!node) return false;
+    if (auto counted = dynamic_cast<CountedNode*>(node)) {
+        return reachedByCollection(counted->inner);
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        return fun->mark == runtime->heap.lastEpoch() || reachedByCollection(fun->body);
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        for (Node* arg : op->args) if (reachedByCollection(arg)) return true;
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        return reachedByCollection(ifn->testExp) || reachedByCollection(ifn->thenExp) ||
+               reachedByCollection(ifn->elseExp);
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        return reachedByCollection(print->exp);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        return reachedByCollection(def->exp);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (Node* stmt : block->stmts) if (reachedByCollection(stmt)) return true;
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        if (reachedByCollection(call->funcExp)) return true;
+        for (Node* arg : call->args) if (reachedByCollection(arg)) return true;
+    }
+    return false;
+}
+
+// Free the retained statements none of whose closures are alive. Runs once
+// the list has doubled since the last time, so the cost stays amortized.
+static void pruneRetained() {
+    runtime->heap.collect();
+    size_t kept = 0;
+    for (Node* stmt : stream->retained) {
+        if (reachedByCollection(stmt)) {
+            stream->retained[kept++] = stmt;
+        } else {
+            delete stmt;
+        }
+    }
+    stream->retained.resize(kept);
+    stream->pruneAt = std::max<size_t>(64, kept * 2);
+}
+
+static void runStatement(Node* stmt) {
+    int funsBefore = stream->resolver.functionCount();
+    int sitesBefore = stream->resolver.callSiteCount();
+    stream->resolver.resolve(stmt);
+    bool hasFunctions = stream->resolver.functionCount() != funsBefore;
+    if (stream->fold) stmt = stream->optimizer.optimize(stmt);
+    if (stats.enabled() && !stream->vm) stmt = stats.instrument(stmt);
+    growGlobals(stream->resolver.globalCount());
+    runtime->callSites.resize(stream->resolver.callSiteCount());
+
+    if (stream->vm) {
+        stream->vm->compile(std::vector<Node*>(1, stmt));
+        stream->vm->run(stream->globals);
+        if (!hasFunctions) stream->vm->discardProgram();
+    } else {
+        stmt->eval(stream->globals);
+    }
+
+    if (!hasFunctions) {
+        delete stmt;
+        // Its call sites were the last ones handed out
+        stream->resolver.releaseCallSites(sitesBefore);
+        runtime->callSites.resize(sitesBefore);
+    } else {
+        stream->retained.push_back(stmt);
+        if (stream->retained.size() >= stream->pruneAt) pruneRetained();
+    }
+}
+
+// --batch: every program gets its own runtime and output buffers and runs
+// on the pool; the results are printed in order, each as soon as it and
+// the ones before it are done.
+namespace {
+struct BatchJob {
+    std::string path;
+    EvalResult result;
+    bool done = false;
+};
+}
+
+// The programs of a batch: the *.lsp files of a directory, sorted, or the
+// paths listed one per line in a manifest
+static bool listBatch(const char* target, std::vector<std::string>& paths) {
+    struct stat info;
+    if (stat(target, &info) != 0) return false;
+    if (S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(target);
+        if (!dir) return false;
+        std::string base = target;
+        if (base.back() != '/') base += '/';
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".lsp") == 0) {
+                paths.push_back(base + name);
+            }
+        }
+        closedir(dir);
+        std::sort(paths.begin(), paths.end());
+        return true;
+    }
+    std::ifstream manifest(target);
+    if (!manifest) return false;
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) paths.push_back(line);
+    }
+    return true;
+}
+
+static int runBatch(const char* target, unsigned jobs, const EvalOptions& options) {
+    std::vector<std::string> paths;
+    if (!listBatch(target, paths)) {
+        std::cerr << "Could not open batch " << target << std::endl;
+        return 1;
+    }
+
+    std::vector<BatchJob> batch(paths.size());
+    std::mutex lock;
+    std::condition_variable finished;
+    ThreadPool pool(jobs);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        batch[i].path = paths[i];
+        BatchJob* job = &batch[i];
+        pool.submit([job, &options, &lock, &finished] {
+            job->result = evaluateFile(job->path, options);
+            std::lock_guard<std::mutex> guard(lock);
+            job->done = true;
+            finished.notify_all();
+        });
+    }
+
+    int status = 0;
+    for (BatchJob& job : batch) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&job] { return job.done; });
+        }
+        std::cout << "==> " << job.path << " <==" << std::endl;
+        std::cout << job.result.output << std::flush;
+        // The header again, for whoever reads stderr on its own
+        if (!job.result.errors.empty()) {
+            std::cerr << "==> " << job.path << " <==" << std::endl;
+            std::cerr << job.result.errors << std::flush;
+        }
+        status = std::max(status, job.result.status);
+    }
+    pool.wait();
+    return status;
+}
+
+int main(int argc, char** argv) {
+    /* 
+       Wait, the user wants to run the interpreter on a file.
+       ./smli example.lsp
+       So we need to accept a filename.
+       Options:
+         --vm           run on the bytecode VM instead of walking the AST
+         --no-fold      skip constant folding
+         --no-infer     keep every run-time type check; inference needs the
+                        whole program, so --stream never uses it
+         --stream       run each statement as soon as it is parsed; output
+                        before a syntax error is then still printed
+         --cache        keep the parsed program in FILE.smlc and load it from
+                        there while FILE is unchanged
+         --line-buffered
+                        pass every print on at once instead of collecting
+                        the output, for interactive use
+         --strict       evaluate all operands of an operator before checking any
+         --heap-stats   print collector statistics to stderr on exit
+         --memoize[=N]  cache results of calls with number/boolean arguments
+                        in a table of N entries (default 65536)
+         --memo-stats   print cache statistics to stderr on exit
+         --profile[=FILE]
+                        print per-function calls and times to stderr on exit
+                        and write folded stacks to FILE (default profile.folded)
+         --bench        print time, allocations and peak RSS of each phase
+                        (parse, resolve, fold, infer, compile, eval) to stderr on exit
+         --batch DIR|MANIFEST
+                        run the *.lsp files of DIR, or the files listed in
+                        MANIFEST, in parallel; each one's output follows a
+                        "==> path <==" line, so do its errors on stderr, and
+                        the exit status is the highest
+         --jobs N       threads for --batch (default: one per core)
+         --jit          compile hot functions to native code (x86-64 only,
+                        ignored elsewhere); tree walker only
+         --jit-stats    print JIT statistics to stderr on exit
+         --parallel[=N] evaluate the operands of calls and operators that
+                        make calls on N threads at once (default: one per
+                        core); tree walker only
+         --emit-cpp     write the program as C++ to stdout instead of running
+                        it, to be built against libsmli (see codegen.h);
+                        --strict, --no-fold and --no-infer apply to it; a
+                        program that does not parse gets its error on
+                        stderr and a failing status, and no C++
+         --serve SOCKET run FILE once as a prelude, then run the snippets
+                        clients send to the Unix socket SOCKET after it,
+                        --jobs at a time (see server.h); no type inference
+         --connect SOCKET
+                        have the server on SOCKET run FILE (or stdin) and
+                        print its output; exits with its status
+         --stats[=FILE] print interpreter counters as JSON on exit, to FILE
+                        or stderr: node evaluations by kind, variable
+                        lookups, calls, allocations and phase times (see
+                        stats.h); nodes, lookups and calls are counted by
+                        the tree walker only
+    */
+    runtime = &mainRuntime;
+    limitStack(threadStackSize());
+    bench.countAllocations(threadAllocations);
+    const char* path = nullptr;
+    const char* batchTarget = nullptr;
+    unsigned jobs = std::thread::hardware_concurrency();
+    EvalOptions options;
+    bool streaming = false;
+    bool heapStats = false;
+    bool memoStats = false;
+    const char* profilePath = nullptr;
+    bool benchmark = false;
+    unsigned threads = 0;
+    bool compiling = false;
+    bool jitStats = false;
+    bool emitting = false;
+    const char* servePath = nullptr;
+    const char* connectPath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--vm") {
+            options.useVM = true;
+        } else if (arg == "--no-fold") {
+            options.fold = false;
+        } else if (arg == "--no-infer") {
+            options.infer = false;
+        } else if (arg == "--stream") {
+            streaming = true;
+        } else if (arg == "--cache") {
+            options.cache = true;
+        } else if (arg == "--line-buffered") {
+            mainRuntime.out.setLineBuffered(true);
+        } else if (arg == "--strict") {
+            strictEval = true;
+        } else if (arg == "--heap-stats") {
+            heapStats = true;
+        } else if (arg == "--memoize") {
+            options.memoEntries = Memo::DEFAULT_ENTRIES;
+        } else if (arg.compare(0, 10, "--memoize=") == 0) {
+            options.memoEntries = std::strtoul(arg.c_str() + 10, nullptr, 10);
+        } else if (arg == "--memo-stats") {
+            memoStats = true;
+        } else if (arg == "--profile" || arg.compare(0, 10, "--profile=") == 0) {
+            profilePath = argv[i] + std::min<size_t>(arg.size(), 10);
+            if (!*profilePath) profilePath = "profile.folded";
+        } else if (arg == "--bench") {
+            benchmark = true;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchTarget = argv[++i];
+        } else if (arg == "--jit") {
+            compiling = true;
+        } else if (arg == "--jit-stats") {
+            jitStats = true;
+        } else if (arg == "--parallel") {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        } else if (arg.compare(0, 11, "--parallel=") == 0) {
+            threads = std::max(1ul, std::strtoul(arg.c_str() + 11, nullptr, 10));
+        } else if (arg == "--emit-cpp") {
+            emitting = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (arg == "--connect" && i + 1 < argc) {
+            connectPath = argv[++i];
+        } else if (arg == "--stats" || arg.compare(0, 8, "--stats=") == 0) {
+            statsPath = argv[i] + std::min<size_t>(arg.size(), 8);
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            jobs = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (connectPath) {
+        // Everything else is up to the server
+        SourceBuffer source;
+        if (path ? !source.open(path) : !source.read(stdin)) {
+            std::cerr << "Could not open file " << (path ? path : "stdin") << std::endl;
+            return 1;
+        }
+        return request(connectPath, std::string(source.data(), source.size()));
+    }
+
+    // Nothing runs, so the options of a run would be ignored
+    if (emitting && (options.useVM || streaming || options.memoEntries || profilePath || batchTarget || compiling ||
+                     threads || servePath)) {
+        std::cerr << "--emit-cpp cannot be combined with --vm, --stream, --memoize, "
+                     "--profile, --batch, --jit, --parallel or --serve" << std::endl;
+        return 1;
+    }
+
+    if (statsPath) {
+        // Native code is not counted, and the passes of --emit-cpp do not
+        // know the counting nodes; --serve never gets to print
+        if (compiling || emitting || servePath) {
+            std::cerr << "--stats cannot be combined with --jit, --emit-cpp or --serve" << std::endl;
+            return 1;
+        }
+        stats.start();
+        stats.attach(&mainRuntime);
+        // The phase times; --bench is not thread safe, and --batch leaves it off
+        if (!batchTarget) bench.start();
+        std::atexit(printStats);
+    }
+
+    if (compiling) {
+        // The code and its counters live on the AST, which --stream frees
+        // and --parallel shares between threads
+        if (options.useVM || streaming || options.memoEntries || profilePath || batchTarget || threads) {
+            std::cerr << "--jit cannot be combined with --vm, --stream, --memoize, "
+                         "--profile, --batch or --parallel" << std::endl;
+            return 1;
+        }
+        if (Jit::supported()) jit.start();
+    }
+    if (jitStats) std::atexit(printJitStats);
+
+    if (threads) {
+        // Their tables are per thread or not thread safe, and --stream
+        // statements are never marked (parallel.h)
+        if (options.useVM || streaming || options.memoEntries || profilePath || batchTarget) {
+            std::cerr << "--parallel cannot be combined with --vm, --stream, --memoize, "
+                         "--profile or --batch" << std::endl;
+            return 1;
+        }
+        parallel.start(threads);
+    }
+
+    if (servePath) {
+        // Snippets run on the pool, each with a runtime of its own, against
+        // the prelude's AST (see Prelude)
+        if (options.useVM || streaming || profilePath || batchTarget || compiling || threads || options.cache) {
+            std::cerr << "--serve cannot be combined with --vm, --stream, --profile, --batch, "
+                         "--jit, --parallel or --cache" << std::endl;
+            return 1;
+        }
+        SourceBuffer source;
+        if (path && !source.open(path)) {
+            std::cerr << "Could not open file " << path << std::endl;
+            return 1;
+        }
+        if (!path) source.assign("", 0);
+        Prelude prelude(source, options);
+        std::cout << prelude.loaded().output << std::flush;
+        std::cerr << prelude.loaded().errors << std::flush;
+        if (!prelude.ok()) return std::max(1, prelude.loaded().status);
+        return serve(servePath, prelude, jobs);
+    }
+
+    if (batchTarget) {
+        // These report on the whole process, not on one program
+        if (streaming || heapStats || memoStats || profilePath || benchmark) {
+            std::cerr << "--batch cannot be combined with --stream, --heap-stats, "
+                         "--memo-stats, --profile or --bench" << std::endl;
+            return 1;
+        }
+        return runBatch(batchTarget, jobs, options);
+    }
+    if (options.memoEntries) mainRuntime.memo.enable(options.memoEntries);
+    // Reports are printed by atexit handlers, so error exits report too
+    if (heapStats) std::atexit(printHeapStats);
+    if (memoStats) std::atexit(printMemoStats);
+    if (profilePath) {
+        profiler.start(profilePath);
+        std::atexit(printProfile);
+    }
+    if (benchmark) {
+        bench.start();
+        std::atexit(printBench);
+    }
+
+    SourceBuffer source;
+    if (path) {
+        if (!source.open(path)) {
+            std::cerr << "Could not open file " << path << std::endl;
+            return 1;
+        }
+    } else {
+        source.read(stdin);
+    }
+
+    // Errors end the program with the status they carry
+    try {
+        if (streaming) {
+            ParseState parse;
+            Stream state;
+            VM vm;
+            state.fold = options.fold;
+            state.vm = options.useVM ? &vm : nullptr;
+            vm.memoizeCalls(options.memoEntries != 0);
+            runtime->heap.markFunctions(true); // For pruneRetained
+            state.globals = runtime->heap.newFrame(nullptr, 0);
+            runtime->heap.pushRoot(state.globals);
+            stream = &state;
+            parse.onStatement = runStatement;
+            bench.phase("stream");
+            parseSource(source, parse);
+            runtime->out.flush();
+            return 0;
+        }
+
+        // Not freed: the process ends right after, and tearing down a
+        // large AST only costs time
+        Program* program = new Program(source, options,
+                                       options.cache && path ? std::string(path) + ".smlc" : std::string());
+        if (emitting) {
+            program->emit(std::cout);
+        } else {
+            program->execute();
+        }
+    } catch (const ProgramError& e) {
+        if (emitting) {
+            // stdout is the C++ source; a syntax error there would be
+            // compiled, and a build should stop here
+            std::cerr << e.message << std::endl;
+            return std::max(1, e.status);
+        }
+        runtime->report(e);
+        return e.status;
+    } catch (...) {
+        // Still ends the process as an uncaught exception, but after
+        // what was printed so far
+        runtime->out.flush();
+        throw;
+    }
+    runtime->out.flush();
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "memo.h"
+
+#include "heap.h"
+
+void Memo::enable(size_t capacity) {
+    size_t sets = 1;
+    while (sets * 2 < capacity) sets *= 2;
+    entries.assign(sets * 2, Entry());
+    setMask = sets - 1;
+}
+
+bool Memo::makeKey(FunNode* fun, Environment* env, const Value* args, size_t argc, Key& key) {
+    if (argc > MAX_ARGS) {
+        counters.uncacheable++;
+        return false;
+    }
+    uint64_t h = reinterpret_cast<uintptr_t>(fun) ^ (reinterpret_cast<uintptr_t>(env) << 1);
+    for (size_t i = 0; i < argc; ++i) {
+        if (!args[i].isFixnum() && !args[i].isBool()) {
+            counters.uncacheable++;
+            return false;
+        }
+        key.args[i] = args[i];
+        h = (h ^ args[i].bits) * 0x9E3779B97F4A7C15ULL;
+    }
+    key.fun = fun;
+    key.env = env;
+    key.argc = argc;
+    key.hash = h ^ (h >> 29);
+    key.collections = heap.stats().collections;
+    return true;
+}
+
+bool Memo::matches(const Entry& e, const Key& key) {
+    if (e.fun != key.fun || e.env != key.env || e.argc != key.argc) return false;
+    for (size_t i = 0; i < key.argc; ++i) {
+        if (e.args[i].bits != key.args[i].bits) return false;
+    }
+    return true;
+}
+
+bool Memo::lookup(const Key& key, Value& result) {
+    Entry* s = set(key.hash);
+    for (int way = 0; way < 2; ++way) {
+        if (matches(s[way], key)) {
+            s[way].used = ++clock;
+            result = s[way].result;
+            counters.hits++;
+            return true;
+        }
+    }
+    counters.misses++;
+    return false;
+}
+
+void Memo::store(const Key& key, Value result) {
+    if (key.collections != heap.stats().collections) return;
+    if (!result.isFixnum() && !result.isBool()) return;
+    Entry* s = set(key.hash);
+    Entry* victim = s[0].used <= s[1].used ? &s[0] : &s[1];
+    for (int way = 0; way < 2; ++way) {
+        if (!s[way].fun || matches(s[way], key)) {
+            victim = &s[way];
+            break;
+        }
+    }
+    if (victim->fun && !matches(*victim, key)) counters.evictions++;
+    victim->fun = key.fun;
+    victim->env = key.env;
+    victim->argc = key.argc;
+    for (size_t i = 0; i < key.argc; ++i) victim->args[i] = key.args[i];
+    victim->result = result;
+    victim->used = ++clock;
+    counters.stores++;
+}
+
+void Memo::sweep(unsigned epoch) {
+    for (Entry& e : entries) {
+        // Closures only capture heap frames and the global frame, so the
+        // mark says whether the environment survives this collection
+        if (e.fun && e.env && e.env->mark != epoch) {
+            e = Entry();
+            counters.purged++;
+        }
+    }
+}
+
+void Memo::printStats(std::ostream& os) const {
+    os << "Memo statistics:" << std::endl
+       << "  entries:            " << entries.size() << std::endl
+       << "  hits:               " << counters.hits << std::endl
+       << "  misses:             " << counters.misses << std::endl
+       << "  uncacheable calls:  " << counters.uncacheable << std::endl
+       << "  stores:             " << counters.stores << std::endl
+       << "  evictions:          " << counters.evictions << std::endl
+       << "  purged by GC:       " << counters.purged << std::endl;
+}
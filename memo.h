@@ -0,0 +1,95 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "ast.h"
+
+class Heap;
+
+// Result cache for --memoize.
+//
+// Every MiniLisp function is pure: there is no mutation, and the grammar
+// never puts print-num/print-bool inside a function body. A call's result
+// therefore only depends on the function, the environment it closes over
+// and its arguments, so a call whose arguments are all fixnums or booleans
+// can be answered from a table keyed by (FunNode, closure env, args). The
+// key uses the closure's contents rather than the FuncData, so closures of
+// the same function over the same frame share entries. Only fixnum and
+// boolean results are kept, which keeps the table out of the collector's
+// roots (a bignum lives on the heap, see number.h); an error exits the program and is never cached.
+//
+// The table has a fixed number of entries in two-way sets. A miss in a full
+// set evicts the least recently used of the two. Entries whose environment
+// did not survive a collection are purged by Heap::collect before the frame
+// is freed.
+class Memo {
+public:
+    static const size_t MAX_ARGS = 4;
+    static const size_t DEFAULT_ENTRIES = 1 << 16;
+
+    // The call a result will be stored under, filled in by makeKey
+    struct Key {
+        FunNode* fun;
+        Environment* env;
+        size_t argc;
+        Value args[MAX_ARGS];
+        uint64_t hash;
+        size_t collections; // Heap collections when the key was made
+    };
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t uncacheable = 0;
+        size_t stores = 0;
+        size_t evictions = 0;
+        size_t purged = 0;
+    };
+
+    // Cache for the calls run on `heap`
+    explicit Memo(const Heap& heap) : heap(heap) {}
+
+    bool enabled() const { return !entries.empty(); }
+
+    // Allocate a table of about `capacity` entries (rounded up to a power of two)
+    void enable(size_t capacity);
+
+    // Build the key of a call; false when the call cannot be cached
+    bool makeKey(FunNode* fun, Environment* env, const Value* args, size_t argc, Key& key);
+
+    bool lookup(const Key& key, Value& result);
+
+    // Remember the result of the call `key` was made for. Dropped when a
+    // collection ran in between, since `key.env` may have been freed.
+    void store(const Key& key, Value result);
+
+    // Drop entries whose environment is not marked in collection `epoch`
+    void sweep(unsigned epoch);
+
+    const Stats& stats() const { return counters; }
+    void printStats(std::ostream& os) const;
+
+private:
+    struct Entry {
+        FunNode* fun = nullptr; // nullptr marks an empty entry
+        Environment* env = nullptr;
+        size_t argc = 0;
+        Value args[MAX_ARGS];
+        Value result;
+        uint64_t used = 0; // Clock of the last lookup or store
+    };
+
+    const Heap& heap;
+    std::vector<Entry> entries;
+    size_t setMask = 0;
+    uint64_t clock = 0;
+    Stats counters;
+
+    Entry* set(uint64_t hash) { return &entries[(hash & setMask) * 2]; }
+    static bool matches(const Entry& e, const Key& key);
+};
+
+#endif
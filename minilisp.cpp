@@ -0,0 +1,270 @@
+#include "minilisp.h"
+
+#include <algorithm>
+#include <sstream>
+#include "bench.h"
+#include "cache.h"
+#include "codegen.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "parse.h"
+#include "resolver.h"
+#include "runtime.h"
+#include "source.h"
+#include "stats.h"
+#include "typer.h"
+#include "vm.h"
+
+Program::Program(const std::string& text, const EvalOptions& options) : options(options) {
+    SourceBuffer source;
+    if (!source.assign(text.data(), text.size())) {
+        failure = std::make_exception_ptr(std::bad_alloc());
+        return;
+    }
+    load(source, std::string());
+}
+
+Program::Program(SourceBuffer& source, const EvalOptions& options) : options(options) {
+    load(source, std::string());
+}
+
+Program::Program(SourceBuffer& source, const EvalOptions& options, const std::string& cachePath)
+    : options(options) {
+    load(source, cachePath);
+}
+
+Program::~Program() {
+    for (Node* stmt : statements) delete stmt;
+}
+
+void Program::load(SourceBuffer& source, const std::string& cachePath) {
+    uint64_t hash = 0;
+    bool cached = false;
+    if (!cachePath.empty()) {
+        bench.phase("load");
+        hash = sourceHash(source.data(), source.size());
+        cached = loadCache(cachePath, hash, options.fold, statements, globalCount, callSites);
+    }
+    if (!cached) {
+        parse(source);
+        if (failure) return;
+        // Not being able to write the cache only costs the next run time
+        if (!cachePath.empty()) saveCache(cachePath, hash, options.fold, statements, globalCount, callSites);
+    }
+
+    // After saving: the cache holds the untyped program, which the format
+    // and every run of it share
+    if (options.infer) {
+        bench.phase("infer");
+        Typer typer;
+        typer.run(statements, globalCount);
+    }
+
+    // On the nodes the Typer leaves; the VM and --memoize never fork
+    if (parallel.enabled() && !options.useVM && !options.memoEntries) {
+        for (Node* stmt : statements) parallel.mark(stmt);
+    }
+
+    // Last, since no other pass knows CountedNode; the VM counts no nodes
+    if (stats.enabled() && !options.useVM) {
+        for (Node*& stmt : statements) stmt = stats.instrument(stmt);
+    }
+
+    if (options.useVM) {
+        bench.phase("compile");
+        vm.reset(new VM);
+        vm->memoizeCalls(options.memoEntries != 0);
+        vm->compile(statements);
+    }
+}
+
+void Program::parse(SourceBuffer& source) {
+    ParseState parse;
+    try {
+        bench.phase("parse");
+        parseSource(source, parse);
+    } catch (...) {
+        for (Node* stmt : parse.program) delete stmt;
+        failure = std::current_exception();
+        return;
+    }
+    statements.swap(parse.program);
+
+    // Bind every variable reference to a (depth, slot) pair
+    bench.phase("resolve");
+    Resolver resolver;
+    for (Node* stmt : statements) {
+        resolver.resolve(stmt);
+    }
+    globalCount = resolver.globalCount();
+    callSites = resolver.callSiteCount();
+
+    if (options.fold) {
+        bench.phase("fold");
+        Optimizer optimizer;
+        for (Node*& stmt : statements) {
+            stmt = optimizer.optimize(stmt);
+        }
+    }
+}
+
+void Program::execute() const {
+    if (failure) std::rethrow_exception(failure);
+
+    Environment* globalEnv = runtime->heap.newFrame(nullptr, globalCount);
+    runtime->heap.pushRoot(globalEnv);
+    // The caches refer to the globals of this run
+    runtime->callSites.assign(callSites, CallSite());
+
+    bench.phase("eval");
+    if (vm) {
+        // Reused by the next runs on this thread
+        static thread_local std::vector<Value> stack;
+        vm->run(globalEnv, stack);
+    } else {
+        for (Node* stmt : statements) {
+            stmt->eval(globalEnv);
+        }
+    }
+    runtime->heap.popRoot();
+}
+
+void Program::emit(std::ostream& os) const {
+    if (failure) std::rethrow_exception(failure);
+    CodeGen codegen;
+    codegen.emit(statements, globalCount, os);
+}
+
+EvalResult Program::run() const {
+    EvalResult result;
+    std::ostringstream out, err;
+    Runtime own(out, err);
+    if (options.memoEntries) own.memo.enable(options.memoEntries);
+    Runtime* outer = runtime;
+    runtime = &own;
+
+    try {
+        execute();
+    } catch (const ProgramError& e) {
+        own.report(e);
+        result.status = e.status;
+    } catch (const std::exception& e) {
+        // An out of range literal, or out of memory; the command line
+        // interpreter would abort
+        err << "Error: " << e.what() << std::endl;
+        result.status = 1;
+    }
+    own.out.flush();
+    runtime = outer;
+
+    result.output = out.str();
+    result.errors = err.str();
+    return result;
+}
+
+struct Prelude::Streams {
+    std::ostringstream out, err;
+};
+
+Prelude::Prelude(SourceBuffer& source, const EvalOptions& options)
+    : options(options), resolver(new Resolver), optimizer(new Optimizer), streams(new Streams),
+      home(new Runtime(streams->out, streams->err)) {
+    Runtime* outer = runtime;
+    runtime = home.get();
+    ParseState parse;
+    try {
+        parseSource(source, parse);
+        statements.swap(parse.program);
+        for (Node* stmt : statements) resolver->resolve(stmt);
+        if (options.fold) {
+            for (Node*& stmt : statements) stmt = optimizer->optimize(stmt);
+        }
+
+        // Not popped: the frame stays a root of `home`, which no longer collects
+        globals = home->heap.newFrame(nullptr, resolver->globalCount());
+        home->heap.pushRoot(globals);
+        home->callSites.assign(resolver->callSiteCount(), CallSite());
+        for (Node* stmt : statements) stmt->eval(globals);
+    } catch (const ProgramError& e) {
+        home->report(e);
+        preludeResult.status = e.status;
+        failed = true;
+    } catch (const std::exception& e) {
+        streams->err << "Error: " << e.what() << std::endl;
+        preludeResult.status = 1;
+        failed = true;
+    }
+    for (Node* stmt : parse.program) delete stmt;
+    home->out.flush();
+    runtime = outer;
+
+    preludeResult.output = streams->out.str();
+    preludeResult.errors = streams->err.str();
+}
+
+Prelude::~Prelude() {
+    // The prelude's closures and frames go with `home`, before their FunNodes
+    home.reset();
+    for (Node* stmt : statements) delete stmt;
+}
+
+EvalResult Prelude::run(const std::string& text) const {
+    if (failed) return preludeResult;
+    EvalResult result;
+    std::ostringstream out, err;
+    Runtime own(out, err);
+    // The prelude's objects belong to `home`, which other snippets read
+    own.heap.shareObjects();
+    if (options.memoEntries) own.memo.enable(options.memoEntries);
+    Runtime* outer = runtime;
+    runtime = &own;
+
+    SourceBuffer source;
+    ParseState parse;
+    try {
+        if (!source.assign(text.data(), text.size())) throw std::bad_alloc();
+        parseSource(source, parse);
+        Resolver snippetResolver(*resolver);
+        for (Node* stmt : parse.program) snippetResolver.resolve(stmt);
+        if (options.fold) {
+            Optimizer snippetOptimizer(*optimizer);
+            for (Node*& stmt : parse.program) stmt = snippetOptimizer.optimize(stmt);
+        }
+
+        Environment* env = own.heap.newFrame(nullptr, snippetResolver.globalCount());
+        std::copy(globals->slots, globals->slots + globals->size, env->slots);
+        own.heap.pushRoot(env);
+        own.callSites.assign(snippetResolver.callSiteCount(), CallSite());
+        for (Node* stmt : parse.program) stmt->eval(env);
+        own.heap.popRoot();
+    } catch (const ProgramError& e) {
+        own.report(e);
+        result.status = e.status;
+    } catch (const std::exception& e) {
+        err << "Error: " << e.what() << std::endl;
+        result.status = 1;
+    }
+    own.out.flush();
+    runtime = outer;
+    // Nothing runs any more, so the snippet's closures may outlive their FunNodes
+    for (Node* stmt : parse.program) delete stmt;
+
+    result.output = out.str();
+    result.errors = err.str();
+    return result;
+}
+
+EvalResult evaluate(const std::string& source, const EvalOptions& options) {
+    return Program(source, options).run();
+}
+
+EvalResult evaluateFile(const std::string& path, const EvalOptions& options) {
+    SourceBuffer source;
+    if (!source.open(path.c_str())) {
+        EvalResult result;
+        result.errors = "Could not open file " + path + "\n";
+        result.status = 1;
+        return result;
+    }
+    return Program(source, options, options.cache ? path + ".smlc" : std::string()).run();
+}
@@ -0,0 +1,130 @@
+#ifndef MINILISP_H
+#define MINILISP_H
+
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ast.h"
+
+class Optimizer;
+class Resolver;
+class Runtime;
+class SourceBuffer;
+class VM;
+
+// Entry point for running MiniLisp programs inside another program, built
+// as the smli library (see compile.ps1). An evaluation never exits the
+// process: errors end only the program being run and come back in its
+// result. Each evaluation gets a runtime of its own (see runtime.h), so
+// evaluations may run on several threads at once. --strict is process-wide
+// and is set through `strictEval` (ast.h); so are the --stats counters,
+// started and printed through `stats` (stats.h).
+
+// Options of one program, the per-program subset of the command line
+struct EvalOptions {
+    bool useVM = false;      // --vm
+    bool fold = true;        // Cleared by --no-fold
+    bool infer = true;       // Cleared by --no-infer (typer.h)
+    size_t memoEntries = 0;  // --memoize=N, 0 for off
+    bool cache = false;      // --cache: evaluateFile keeps PATH.smlc (cache.h)
+};
+
+struct EvalResult {
+    std::string output; // What the program printed
+    std::string errors; // Error messages the interpreter sends to stderr
+    int status = 0;     // The exit code the command line interpreter would use
+};
+
+// A source parsed, resolved, folded, typed and, with useVM, compiled once, to be
+// run any number of times. Every run starts from fresh globals. Running
+// does not change the Program, so one Program can be run by several
+// threads at the same time.
+class Program {
+public:
+    explicit Program(const std::string& source, const EvalOptions& options = EvalOptions());
+    explicit Program(SourceBuffer& source, const EvalOptions& options = EvalOptions());
+    // Load the program from the cache file instead when it is up to date,
+    // and write one otherwise
+    Program(SourceBuffer& source, const EvalOptions& options, const std::string& cachePath);
+    ~Program();
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    // False after a syntax error, which every run then reports
+    bool ok() const { return !failure; }
+
+    // Run on a runtime of its own and capture the output
+    EvalResult run() const;
+
+    // Run on the current runtime; errors are thrown as a ProgramError
+    void execute() const;
+
+    // Write the program as C++ to build against the library (--emit-cpp,
+    // see codegen.h); a syntax error is thrown as execute() throws it
+    void emit(std::ostream& os) const;
+
+private:
+    EvalOptions options;
+    std::vector<Node*> statements;
+    int globalCount = 0;
+    int callSites = 0; // Inline caches a run needs (CallNode::site)
+    std::unique_ptr<VM> vm;
+    std::exception_ptr failure; // What parsing threw, if anything
+
+    void load(SourceBuffer& source, const std::string& cachePath);
+    void parse(SourceBuffer& source);
+};
+
+// Definitions evaluated once that many snippets, each a program of its
+// own, then run against (--serve, see server.h). The prelude is resolved,
+// folded and run when it is made, on a runtime the Prelude keeps, and
+// stays loaded: its functions are not parsed again, and its globals keep
+// their values. A snippet is resolved as the statements that follow the
+// prelude, and runs on a runtime of its own with a global frame that
+// starts as a copy of the prelude's. Globals cannot be redefined, so a
+// snippet can only add to that frame, and what one snippet defines is
+// never seen by another. Prelude functions see only the prelude's globals.
+//
+// Snippets may run on several threads at once. Type inference needs the
+// whole program, so neither the prelude nor the snippets use it, and
+// useVM is not supported.
+class Prelude {
+public:
+    Prelude(SourceBuffer& source, const EvalOptions& options = EvalOptions());
+    ~Prelude();
+    Prelude(const Prelude&) = delete;
+    Prelude& operator=(const Prelude&) = delete;
+
+    // False when the prelude did not load: a syntax error, or an error
+    // running it, which loaded() reports
+    bool ok() const { return !failed; }
+
+    // What running the prelude printed
+    const EvalResult& loaded() const { return preludeResult; }
+
+    // Run `source` after the prelude and capture its output; a prelude
+    // that did not load gives its own result again
+    EvalResult run(const std::string& source) const;
+
+private:
+    struct Streams;
+
+    EvalOptions options;
+    std::unique_ptr<Resolver> resolver;   // As of the end of the prelude
+    std::unique_ptr<Optimizer> optimizer;
+    std::vector<Node*> statements;
+    std::unique_ptr<Streams> streams;     // Of `home`
+    std::unique_ptr<Runtime> home;        // Holds the prelude's values
+    Environment* globals = nullptr;
+    EvalResult preludeResult;
+    bool failed = false;
+};
+
+// Compile and run a source once
+EvalResult evaluate(const std::string& source, const EvalOptions& options = EvalOptions());
+EvalResult evaluateFile(const std::string& path, const EvalOptions& options = EvalOptions());
+
+#endif
@@ -0,0 +1,353 @@
+#include "number.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
+#include "heap.h"
+#include "runtime.h"
+
+namespace {
+
+// A number as sign and magnitude, read in place: a bignum's own limbs, or
+// a fixnum spread over two local ones
+struct Operand {
+    const uint32_t* limbs;
+    uint32_t size;
+    bool negative;
+    uint32_t local[2];
+
+    explicit Operand(Value v) {
+        if (v.isFixnum()) {
+            int64_t n = v.num();
+            negative = n < 0;
+            uint64_t m = negative ? 0 - uint64_t(n) : uint64_t(n);
+            local[0] = uint32_t(m);
+            local[1] = uint32_t(m >> 32);
+            limbs = local;
+            size = local[1] ? 2 : local[0] ? 1 : 0;
+        } else {
+            Bignum* b = v.bignum();
+            limbs = b->limbs();
+            size = b->size;
+            negative = b->negative;
+        }
+    }
+    Operand(const Operand&) = delete;
+    Operand& operator=(const Operand&) = delete;
+};
+
+// Result under construction. Up to SMALL limbs live in the object itself,
+// so moderately sized intermediates never touch the allocator.
+class Result {
+public:
+    bool negative = false;
+    uint32_t size = 0;
+
+    Result() : limbs(small), capacity(SMALL) {}
+    ~Result() { if (limbs != small) delete[] limbs; }
+    Result(const Result&) = delete;
+    Result& operator=(const Result&) = delete;
+
+    // Room for `n` limbs, all zero
+    uint32_t* clear(uint32_t n) {
+        if (n > capacity) {
+            if (limbs != small) delete[] limbs;
+            limbs = new uint32_t[n];
+            capacity = n;
+        }
+        std::fill(limbs, limbs + n, 0u);
+        size = n;
+        return limbs;
+    }
+
+    // Normalized: a fixnum when it fits, else a bignum on `heap` or, with
+    // none, a permanent one
+    Value value(Heap* heap) {
+        while (size && !limbs[size - 1]) --size;
+        if (size <= 2) {
+            uint64_t m = size == 2 ? (uint64_t(limbs[1]) << 32) | limbs[0] : size ? limbs[0] : 0;
+            if (!negative && m <= uint64_t(Value::FIXNUM_MAX)) return Value::fixnum(int64_t(m));
+            if (negative && m <= uint64_t(Value::FIXNUM_MAX) + 1) return Value::fixnum(int64_t(0 - m));
+        }
+        Bignum* b = heap ? heap->newBignum(size) : permanentBignum(size);
+        b->negative = negative;
+        std::memcpy(b->limbs(), limbs, size * sizeof(uint32_t));
+        return Value(b);
+    }
+
+private:
+    static const uint32_t SMALL = 8;
+    uint32_t small[SMALL];
+    uint32_t* limbs;
+    uint32_t capacity;
+
+    static Bignum* permanentBignum(uint32_t size) {
+        Bignum* b = static_cast<Bignum*>(::operator new(Bignum::bytesFor(size)));
+        new (b) Bignum();
+        b->permanent = true;
+        b->size = size;
+        return b;
+    }
+};
+
+int compareMagnitudes(const Operand& a, const Operand& b) {
+    if (a.size != b.size) return a.size < b.size ? -1 : 1;
+    for (uint32_t i = a.size; i-- > 0;) {
+        if (a.limbs[i] != b.limbs[i]) return a.limbs[i] < b.limbs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// |a| + |b|
+void addMagnitudes(const Operand& a, const Operand& b, Result& out) {
+    const Operand& longer = a.size >= b.size ? a : b;
+    const Operand& shorter = a.size >= b.size ? b : a;
+    uint32_t* r = out.clear(longer.size + 1);
+    uint64_t carry = 0;
+    for (uint32_t i = 0; i < longer.size; ++i) {
+        uint64_t sum = carry + longer.limbs[i] + (i < shorter.size ? shorter.limbs[i] : 0);
+        r[i] = uint32_t(sum);
+        carry = sum >> 32;
+    }
+    r[longer.size] = uint32_t(carry);
+}
+
+// |a| - |b| where |a| >= |b|
+void subMagnitudes(const Operand& a, const Operand& b, Result& out) {
+    uint32_t* r = out.clear(a.size);
+    int64_t borrow = 0;
+    for (uint32_t i = 0; i < a.size; ++i) {
+        int64_t d = int64_t(a.limbs[i]) - (i < b.size ? b.limbs[i] : 0) - borrow;
+        borrow = d < 0;
+        r[i] = uint32_t(d + (borrow << 32));
+    }
+}
+
+// a + b, with b's sign flipped for a subtraction
+Value addSigned(Value a, Value b, bool flipB) {
+    Operand x(a), y(b);
+    bool yNegative = y.negative != flipB;
+    Result out;
+    if (x.negative == yNegative) {
+        addMagnitudes(x, y, out);
+        out.negative = x.negative;
+    } else if (compareMagnitudes(x, y) >= 0) {
+        subMagnitudes(x, y, out);
+        out.negative = x.negative;
+    } else {
+        subMagnitudes(y, x, out);
+        out.negative = yNegative;
+    }
+    return out.value(&runtime->heap);
+}
+
+// Quotient and remainder of the magnitudes, |a| >= |b| > 0 (Knuth's
+// algorithm D as in Hacker's Delight)
+void divideMagnitudes(const Operand& a, const Operand& b, Result* quotient, Result* remainder) {
+    uint32_t m = a.size, n = b.size;
+    const uint32_t* u = a.limbs;
+    const uint32_t* v = b.limbs;
+    uint32_t* q = quotient ? quotient->clear(m - n + 1) : nullptr;
+
+    if (n == 1) {
+        uint64_t rest = 0;
+        for (uint32_t j = m; j-- > 0;) {
+            uint64_t part = (rest << 32) | u[j];
+            if (q) q[j] = uint32_t(part / v[0]);
+            rest = part % v[0];
+        }
+        if (remainder) remainder->clear(1)[0] = uint32_t(rest);
+        return;
+    }
+
+    // Normalize so that the top limb of the divisor has its high bit set
+    int s = __builtin_clz(v[n - 1]);
+    std::vector<uint32_t> vn(n), un(m + 1);
+    for (uint32_t i = n - 1; i > 0; --i) {
+        vn[i] = (v[i] << s) | (s ? uint32_t(uint64_t(v[i - 1]) >> (32 - s)) : 0);
+    }
+    vn[0] = v[0] << s;
+    un[m] = s ? uint32_t(uint64_t(u[m - 1]) >> (32 - s)) : 0;
+    for (uint32_t i = m - 1; i > 0; --i) {
+        un[i] = (u[i] << s) | (s ? uint32_t(uint64_t(u[i - 1]) >> (32 - s)) : 0);
+    }
+    un[0] = u[0] << s;
+
+    const uint64_t BASE = uint64_t(1) << 32;
+    for (uint32_t j = m - n + 1; j-- > 0;) {
+        uint64_t top = (uint64_t(un[j + n]) << 32) | un[j + n - 1];
+        uint64_t qhat = top / vn[n - 1];
+        uint64_t rhat = top % vn[n - 1];
+        while (qhat >= BASE || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            --qhat;
+            rhat += vn[n - 1];
+            if (rhat >= BASE) break;
+        }
+
+        // Multiply and subtract
+        int64_t borrow = 0;
+        int64_t t;
+        for (uint32_t i = 0; i < n; ++i) {
+            uint64_t p = qhat * vn[i];
+            t = int64_t(un[i + j]) - borrow - int64_t(p & 0xFFFFFFFFu);
+            un[i + j] = uint32_t(t);
+            borrow = int64_t(p >> 32) - (t >> 32);
+        }
+        t = int64_t(un[j + n]) - borrow;
+        un[j + n] = uint32_t(t);
+
+        if (t < 0) {
+            // Subtracted one time too many; add back
+            --qhat;
+            uint64_t carry = 0;
+            for (uint32_t i = 0; i < n; ++i) {
+                uint64_t sum = uint64_t(un[i + j]) + vn[i] + carry;
+                un[i + j] = uint32_t(sum);
+                carry = sum >> 32;
+            }
+            un[j + n] += uint32_t(carry);
+        }
+        if (q) q[j] = uint32_t(qhat);
+    }
+
+    if (remainder) {
+        uint32_t* r = remainder->clear(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            r[i] = (un[i] >> s) | (s ? uint32_t(uint64_t(un[i + 1]) << (32 - s)) : 0);
+        }
+    }
+}
+
+// Divide in place by a single limb, returning the remainder
+uint32_t divideSmall(std::vector<uint32_t>& limbs, uint32_t divisor) {
+    uint64_t rest = 0;
+    for (size_t j = limbs.size(); j-- > 0;) {
+        uint64_t part = (rest << 32) | limbs[j];
+        limbs[j] = uint32_t(part / divisor);
+        rest = part % divisor;
+    }
+    while (!limbs.empty() && !limbs.back()) limbs.pop_back();
+    return uint32_t(rest);
+}
+
+} // namespace
+
+Value addSlow(Value a, Value b) {
+    return addSigned(a, b, false);
+}
+
+Value subSlow(Value a, Value b) {
+    return addSigned(a, b, true);
+}
+
+Value mulSlow(Value a, Value b) {
+    Operand x(a), y(b);
+    Result out;
+    uint32_t* r = out.clear(x.size + y.size);
+    for (uint32_t i = 0; i < x.size; ++i) {
+        uint64_t carry = 0;
+        for (uint32_t j = 0; j < y.size; ++j) {
+            uint64_t t = uint64_t(x.limbs[i]) * y.limbs[j] + r[i + j] + carry;
+            r[i + j] = uint32_t(t);
+            carry = t >> 32;
+        }
+        r[i + y.size] = uint32_t(carry);
+    }
+    out.negative = x.negative != y.negative;
+    return out.value(&runtime->heap);
+}
+
+Value divSlow(Value a, Value b) {
+    // The long division needs a divisor; the callers check already
+    if (numIsZero(b)) divisionByZeroError();
+    Operand x(a), y(b);
+    if (compareMagnitudes(x, y) < 0) return Value(0);
+    Result quotient;
+    divideMagnitudes(x, y, &quotient, nullptr);
+    quotient.negative = x.negative != y.negative;
+    return quotient.value(&runtime->heap);
+}
+
+Value modSlow(Value a, Value b) {
+    if (numIsZero(b)) divisionByZeroError();
+    Operand x(a), y(b);
+    if (compareMagnitudes(x, y) < 0) return a;
+    Result remainder;
+    divideMagnitudes(x, y, nullptr, &remainder);
+    remainder.negative = x.negative; // The sign of the dividend
+    return remainder.value(&runtime->heap);
+}
+
+int compareSlow(Value a, Value b) {
+    Operand x(a), y(b);
+    if (x.negative != y.negative) return x.negative ? -1 : 1;
+    int c = compareMagnitudes(x, y);
+    return x.negative ? -c : c;
+}
+
+Value parseNumber(const char* text, size_t length) {
+    bool negative = text[0] == '-';
+    size_t i = negative ? 1 : 0;
+    // Up to 18 digits cannot leave an int64_t
+    if (length - i <= 18) {
+        int64_t v = 0;
+        for (; i < length; ++i) v = v * 10 + (text[i] - '0');
+        if (negative) v = -v;
+        if (v >= Value::FIXNUM_MIN && v <= Value::FIXNUM_MAX) return Value::fixnum(v);
+        i = negative ? 1 : 0;
+    }
+
+    // Nine digits at a time: limbs = limbs * 10^k + chunk
+    std::vector<uint32_t> limbs;
+    while (i < length) {
+        uint32_t chunk = 0, scale = 1;
+        for (int k = 0; k < 9 && i < length; ++k, ++i) {
+            chunk = chunk * 10 + uint32_t(text[i] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (uint32_t& limb : limbs) {
+            uint64_t t = uint64_t(limb) * scale + carry;
+            limb = uint32_t(t);
+            carry = t >> 32;
+        }
+        if (carry) limbs.push_back(uint32_t(carry));
+    }
+    return makeNumber(negative, limbs.data(), uint32_t(limbs.size()));
+}
+
+Value makeNumber(bool negative, const uint32_t* limbs, uint32_t size) {
+    Result out;
+    if (size) std::memcpy(out.clear(size), limbs, size * sizeof(uint32_t));
+    out.negative = negative;
+    return out.value(nullptr);
+}
+
+Value importNumber(bool negative, const uint32_t* limbs, uint32_t size) {
+    Result out;
+    if (size) std::memcpy(out.clear(size), limbs, size * sizeof(uint32_t));
+    out.negative = negative;
+    return out.value(&runtime->heap);
+}
+
+void freeNumber(Value v) {
+    if (v.isBignum() && v.bignum()->permanent) ::operator delete(v.bignum());
+}
+
+std::string numberText(Value v) {
+    if (v.isFixnum()) return std::to_string(v.num());
+    Bignum* b = v.bignum();
+    std::vector<uint32_t> limbs(b->limbs(), b->limbs() + b->size);
+    std::string digits;
+    while (!limbs.empty()) {
+        uint32_t chunk = divideSmall(limbs, 1000000000u);
+        for (int k = 0; k < 9 && (chunk || !limbs.empty()); ++k) {
+            digits += char('0' + chunk % 10);
+            chunk /= 10;
+        }
+    }
+    if (b->negative) digits += '-';
+    std::reverse(digits.begin(), digits.end());
+    return digits;
+}
@@ -0,0 +1,151 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "ast.h"
+#include "output.h"
+
+// Integers of any size. A number that fits in 61 bits is a fixnum kept in
+// the Value itself; anything larger is a Bignum, an immutable sign and
+// magnitude allocated on the runtime's heap (heap.h), or owned by the
+// NumberNode of a literal. Every result is normalized, so a number is a
+// bignum exactly when it does not fit a fixnum.
+//
+// The operations below do fixnums in line, with the overflow builtins on
+// the tagged words, and leave everything else to an out of line slow path
+// that works on 32-bit limbs with an in-place buffer for the intermediate
+// result, so only the final bignum is allocated. Their operands must be
+// numbers (checked, or proven by the Typer).
+struct Bignum {
+    unsigned mark = 0;  // Last collection that reached it (see Heap::collect)
+    bool permanent;     // Owned by a literal, never collected
+    bool negative;
+    uint32_t size;      // Limbs, least significant first; the last is nonzero
+
+    uint32_t* limbs() { return reinterpret_cast<uint32_t*>(this + 1); }
+    static size_t bytesFor(uint32_t size) { return sizeof(Bignum) + size * sizeof(uint32_t); }
+};
+
+Value addSlow(Value a, Value b);
+Value subSlow(Value a, Value b);
+Value mulSlow(Value a, Value b);
+Value divSlow(Value a, Value b);
+Value modSlow(Value a, Value b);
+int compareSlow(Value a, Value b);
+
+// For two numbers, both fixnums exactly when neither has the bignum bit
+inline bool bothFixnums(Value a, Value b) { return ((a.bits | b.bits) & Value::TAG_MASK) == Value::NUMBER_TAG; }
+
+// The fixnum results; false when an operand is a bignum or it overflows
+inline bool fixnumAdd(Value a, Value b, Value& result) {
+    int64_t sum;
+    if (!bothFixnums(a, b) ||
+        __builtin_add_overflow(int64_t(a.bits), int64_t(b.bits - Value::NUMBER_TAG), &sum)) {
+        return false;
+    }
+    result.bits = uint64_t(sum);
+    return true;
+}
+
+inline bool fixnumSub(Value a, Value b, Value& result) {
+    int64_t difference;
+    if (!bothFixnums(a, b) ||
+        __builtin_sub_overflow(int64_t(a.bits), int64_t(b.bits - Value::NUMBER_TAG), &difference)) {
+        return false;
+    }
+    result.bits = uint64_t(difference);
+    return true;
+}
+
+inline bool fixnumMul(Value a, Value b, Value& result) {
+    int64_t product;
+    if (!bothFixnums(a, b) ||
+        __builtin_mul_overflow(int64_t(a.bits - Value::NUMBER_TAG), b.num(), &product)) {
+        return false;
+    }
+    result.bits = uint64_t(product) | Value::NUMBER_TAG;
+    return true;
+}
+
+// The divisor is not zero; only FIXNUM_MIN / -1 leaves the range
+inline bool fixnumDiv(Value a, Value b, Value& result) {
+    if (!bothFixnums(a, b) || (a.num() == Value::FIXNUM_MIN && b.num() == -1)) return false;
+    result = Value::fixnum(a.num() / b.num());
+    return true;
+}
+
+inline bool fixnumMod(Value a, Value b, Value& result) {
+    if (!bothFixnums(a, b)) return false;
+    result = Value::fixnum(a.num() % b.num());
+    return true;
+}
+
+inline Value numAdd(Value a, Value b) {
+    Value result;
+    return fixnumAdd(a, b, result) ? result : addSlow(a, b);
+}
+
+inline Value numSub(Value a, Value b) {
+    Value result;
+    return fixnumSub(a, b, result) ? result : subSlow(a, b);
+}
+
+inline Value numMul(Value a, Value b) {
+    Value result;
+    return fixnumMul(a, b, result) ? result : mulSlow(a, b);
+}
+
+// `/` and mod truncate toward zero, as C++ does. The divisor is not zero:
+// the fast paths would trap on it, and the slow ones throw the division
+// error.
+inline Value numDiv(Value a, Value b) {
+    Value result;
+    return fixnumDiv(a, b, result) ? result : divSlow(a, b);
+}
+
+inline Value numMod(Value a, Value b) {
+    Value result;
+    return fixnumMod(a, b, result) ? result : modSlow(a, b);
+}
+
+inline bool numIsZero(Value v) { return v.bits == Value(0).bits; }
+
+// Tags are equal for two fixnums, so their words compare as the numbers do
+inline bool numLess(Value a, Value b) {
+    return bothFixnums(a, b) ? int64_t(a.bits) < int64_t(b.bits) : compareSlow(a, b) < 0;
+}
+
+// Normalized numbers are equal only when they are the same kind
+inline bool numEqual(Value a, Value b) {
+    return a.bits == b.bits || (a.isBignum() && b.isBignum() && compareSlow(a, b) == 0);
+}
+
+// The value of a literal: a fixnum, or a permanent bignum
+Value parseNumber(const char* text, size_t length);
+
+// A permanent number from its sign and limbs, as the .smlc cache stores it
+Value makeNumber(bool negative, const uint32_t* limbs, uint32_t size);
+
+// The same number on the runtime's heap, from the sign and limbs of one
+// that lives on another (--parallel, see parallel.h)
+Value importNumber(bool negative, const uint32_t* limbs, uint32_t size);
+
+// Free the bignum of a literal, if it has one
+void freeNumber(Value v);
+
+// Decimal text of a number
+std::string numberText(Value v);
+
+// print-num
+inline void printNumber(OutputBuffer& out, Value v) {
+    if (v.isFixnum()) {
+        out.printNumber(v.num());
+    } else {
+        std::string text = numberText(v);
+        out.printLine(text.data(), text.size());
+    }
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "optimizer.h"
+
+#include "number.h"
+
+namespace {
+
+// Bignum literals are left alone: a copy would need an owner
+bool isLiteral(Node* node, Value& v) {
+    if (auto num = dynamic_cast<NumberNode*>(node)) {
+        v = num->val;
+        return v.isFixnum();
+    }
+    if (auto b = dynamic_cast<BoolNode*>(node)) {
+        v = Value(b->val);
+        return true;
+    }
+    return false;
+}
+
+Node* makeLiteral(const Value& v) {
+    if (v.isNumber()) return new NumberNode(v);
+    return new BoolNode(v.boolean());
+}
+
+// Whether the arithmetic of `op` on fixnum literals stays a fixnum. A
+// bignum result would need the heap of a runtime, which folding has not.
+bool fixnumResult(BinaryOpNode* op) {
+    Value literal, result;
+    isLiteral(op->args[0], result);
+    for (size_t i = 1; i < op->args.size(); ++i) {
+        isLiteral(op->args[i], literal);
+        bool fits = true;
+        switch (op->op) {
+        case OpCode::ADD: fits = fixnumAdd(result, literal, result); break;
+        case OpCode::SUB: fits = fixnumSub(result, literal, result); break;
+        case OpCode::MUL: fits = fixnumMul(result, literal, result); break;
+        case OpCode::DIV: fits = fixnumDiv(result, literal, result); break;
+        default: break;
+        }
+        if (!fits) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+Node* Optimizer::optimize(Node* stmt) {
+    nesting = 0;
+    Node* result = fold(stmt);
+
+    // Later statements may use the value of a literal global
+    if (auto def = dynamic_cast<DefineNode*>(result)) {
+        Value v;
+        if (isLiteral(def->exp, v) && !globalConstants.count(def->slot)) {
+            globalConstants[def->slot] = v;
+        }
+    }
+    return result;
+}
+
+Node* Optimizer::foldOp(BinaryOpNode* op) {
+    for (Node*& arg : op->args) arg = fold(arg);
+
+    // Operand types the operator accepts without raising an error
+    ValType want = ValType::NUMBER;
+    if (op->op == OpCode::AND || op->op == OpCode::OR || op->op == OpCode::NOT) {
+        want = ValType::BOOLEAN;
+    }
+    for (Node* arg : op->args) {
+        Value v;
+        if (!isLiteral(arg, v) || v.type() != want) return op;
+    }
+    if (op->op == OpCode::DIV || op->op == OpCode::MOD) {
+        Value divisor;
+        isLiteral(op->args[1], divisor);
+        if (numIsZero(divisor)) return op;
+    }
+    if (!fixnumResult(op)) return op;
+
+    // Literal operands never touch the environment
+    Node* folded = makeLiteral(op->eval(nullptr));
+    delete op;
+    return folded;
+}
+
+Node* Optimizer::fold(Node* node) {
+    if (auto var = dynamic_cast<VariableNode*>(node)) {
+        if (var->depth == nesting) {
+            auto it = globalConstants.find(var->slot);
+            if (it != globalConstants.end()) {
+                delete var;
+                return makeLiteral(it->second);
+            }
+        }
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        return foldOp(op);
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        ifn->testExp = fold(ifn->testExp);
+        ifn->thenExp = fold(ifn->thenExp);
+        ifn->elseExp = fold(ifn->elseExp);
+        if (auto test = dynamic_cast<BoolNode*>(ifn->testExp)) {
+            Node*& taken = test->val ? ifn->thenExp : ifn->elseExp;
+            Node* branch = taken;
+            taken = nullptr; // Keep it alive when the IfNode goes
+            delete ifn;
+            return branch;
+        }
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        print->exp = fold(print->exp);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        def->exp = fold(def->exp);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (Node*& stmt : block->stmts) stmt = fold(stmt);
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        int outer = nesting;
+        nesting = fun->globalDepth();
+        fun->body = fold(fun->body);
+        nesting = outer;
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        call->funcExp = fold(call->funcExp);
+        for (Node*& arg : call->args) arg = fold(arg);
+    }
+    return node;
+}
@@ -0,0 +1,31 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <map>
+#include "ast.h"
+
+// Constant folding over the resolved program, run between the resolver and
+// evaluation. It
+//   - folds BinaryOpNodes whose operands are all literals,
+//   - keeps only the taken branch of an IfNode with a literal test,
+//   - replaces references to global defines of a literal with the literal.
+//
+// A node is only folded when evaluating it cannot fail: an operator with a
+// wrongly typed literal or a zero divisor is left for the evaluator, so type
+// errors still appear at the same point of the output. A global constant is
+// only inlined into statements after its define, since those always run
+// after it and redefinition is an error.
+class Optimizer {
+public:
+    // Optimize one top-level statement and return its replacement
+    Node* optimize(Node* stmt);
+
+private:
+    std::map<int, Value> globalConstants; // Global slot -> literal value
+    int nesting = 0;                      // Frames up to the global one
+
+    Node* fold(Node* node);
+    Node* foldOp(BinaryOpNode* op);
+};
+
+#endif
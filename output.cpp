@@ -0,0 +1,24 @@
+#include "output.h"
+
+void OutputBuffer::printLine(const char* text, size_t length) {
+    if (SIZE - used <= length) {
+        flush();
+        if (SIZE <= length) {
+            sink->write(text, length);
+            *sink << '\n';
+            sink->flush();
+            return;
+        }
+    }
+    std::memcpy(buffer + used, text, length);
+    used += length;
+    endLine();
+}
+
+void OutputBuffer::flush() {
+    if (used) {
+        sink->write(buffer, used);
+        used = 0;
+    }
+    sink->flush();
+}
@@ -0,0 +1,66 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+// What print-num and print-bool write, collected in a fixed buffer and
+// handed to the stream in one write when the buffer fills, when an error
+// is reported (see Runtime::report) and when the program ends. Numbers
+// are formatted by hand instead of through the stream. With line
+// buffering every print is passed on at once, as std::endl did.
+class OutputBuffer {
+public:
+    static const size_t SIZE = 16 * 1024;
+
+    explicit OutputBuffer(std::ostream& sink) : sink(&sink) {}
+    ~OutputBuffer() { flush(); }
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void setLineBuffered(bool on) { lineBuffered = on; }
+
+    void printNumber(int64_t n) {
+        if (SIZE - used < 24) flush();
+        char digits[20];
+        char* p = digits + sizeof digits;
+        uint64_t u = n < 0 ? 0 - uint64_t(n) : uint64_t(n);
+        do {
+            *--p = char('0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (n < 0) *--p = '-';
+        size_t length = digits + sizeof digits - p;
+        std::memcpy(buffer + used, p, length);
+        used += length;
+        endLine();
+    }
+
+    void printBool(bool b) {
+        if (SIZE - used < 16) flush();
+        std::memcpy(buffer + used, b ? "#t" : "#f", 2);
+        used += 2;
+        endLine();
+    }
+
+    // A whole line, such as an error message; `text` has no newline
+    void printLine(const char* text, size_t length);
+
+    // Pass everything buffered on to the stream, and flush that too
+    void flush();
+
+private:
+    std::ostream* sink;
+    size_t used = 0;
+    bool lineBuffered = false;
+    char buffer[SIZE];
+
+    void endLine() {
+        buffer[used++] = '\n';
+        if (lineBuffered) flush();
+    }
+};
+
+#endif
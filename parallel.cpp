@@ -0,0 +1,239 @@
+#include "parallel.h"
+
+#include <atomic>
+#include <ostream>
+#include <thread>
+#include "number.h"
+#include "runtime.h"
+
+namespace {
+
+// Forks the evaluation on this thread is nested in
+thread_local int forkDepth = 0;
+
+struct Fork;
+
+// An operand being evaluated, and the one its fork is evaluated for
+struct Job {
+    Fork* fork;
+    size_t index;
+    const Job* outer;
+};
+
+// The operand this thread evaluates, innermost
+thread_local const Job* job = nullptr;
+
+// Thrown by ParallelEval::poll through an operand that is not needed
+struct Abandoned {};
+
+// Runtime of a pool worker, made by its first task. Tasks cannot print, and
+// errors are thrown, so nothing is ever written to its streams.
+std::ostream nowhere(nullptr);
+thread_local std::unique_ptr<Runtime> workerRuntime;
+
+// One operand of a fork, in a form any runtime can take over
+struct Operand {
+    Value value;                  // A fixnum or a boolean
+    bool bignum = false;          // Or the number in `negative` and `limbs`
+    bool negative = false;
+    std::vector<uint32_t> limbs;
+    bool rerun = false;           // Or a function, to be evaluated again
+    std::exception_ptr error;     // Or what the evaluation threw
+};
+
+struct Fork {
+    const std::vector<Node*>& args;
+    Environment* env;
+    int depth;           // forkDepth of the tasks
+    size_t sites;        // Call site caches of the program
+    bool numbers;        // Whether an operand that is not a number fails
+    const Job* outer;    // The operand the fork is evaluated for
+    std::vector<Operand> operands;
+    std::atomic<size_t> left;     // Tasks not finished yet
+    std::atomic<size_t> failedAt; // First operand known to fail, or args.size()
+
+    Fork(const std::vector<Node*>& args, Environment* env, bool numbers)
+        : args(args), env(env), depth(forkDepth + 1), sites(runtime->callSites.size()), numbers(numbers),
+          outer(job), operands(args.size()), left(args.size() - 1), failedAt(args.size()) {}
+
+    // Operand `i` failed: the ones after it are not needed
+    void fail(size_t i) {
+        size_t first = failedAt.load();
+        while (i < first && !failedAt.compare_exchange_weak(first, i)) {}
+    }
+};
+
+bool cancelled(const Job* j) {
+    for (; j; j = j->outer) {
+        if (j->fork->failedAt.load(std::memory_order_relaxed) < j->index) return true;
+    }
+    return false;
+}
+
+// Evaluate operand `i` of `fork` on this thread
+void runTask(Fork& fork, size_t i) {
+    Runtime* outer = runtime;
+    if (!runtime) {
+        if (!workerRuntime) {
+            workerRuntime.reset(new Runtime(nowhere, nowhere));
+            workerRuntime->heap.shareObjects();
+        }
+        runtime = workerRuntime.get();
+    }
+    if (runtime->callSites.size() < fork.sites) runtime->callSites.resize(fork.sites);
+    int outerDepth = forkDepth;
+    forkDepth = fork.depth;
+    Job mine = {&fork, i, fork.outer};
+    const Job* outerJob = job;
+    job = &mine;
+
+    // An error leaves the frames of the calls it came out of behind; this
+    // runtime may go on with other tasks, so drop them. The empty frame
+    // marks where the arena stood.
+    size_t roots = runtime->heap.rootCount();
+    Environment* base = runtime->frames.push(nullptr, 0);
+    Operand& operand = fork.operands[i];
+    try {
+        if (cancelled(job)) throw Abandoned();
+        Value v = fork.args[i]->eval(fork.env);
+        if (fork.numbers && !v.isNumber()) fork.fail(i);
+        if (v.isBignum()) {
+            Bignum* b = v.bignum();
+            operand.bignum = true;
+            operand.negative = b->negative;
+            operand.limbs.assign(b->limbs(), b->limbs() + b->size);
+        } else if (v.isFunction()) {
+            operand.rerun = true;
+        } else {
+            operand.value = v;
+        }
+    } catch (...) {
+        operand.error = std::current_exception();
+        fork.fail(i);
+    }
+    runtime->heap.popRoots(roots);
+    runtime->frames.pop(base);
+
+    job = outerJob;
+    forkDepth = outerDepth;
+    runtime = outer;
+}
+
+} // namespace
+
+// After `nowhere`: the pool stops first, and the workers' runtimes flush to it
+ParallelEval parallel;
+
+void ParallelEval::start(unsigned threads) {
+    if (threads == 0) threads = 1;
+    // The forking thread is one of them
+    pool.reset(new ThreadPool(threads > 1 ? threads - 1 : 1));
+    cutoff = 3;
+    while ((1u << cutoff) < threads * 8) ++cutoff;
+}
+
+bool ParallelEval::shouldFork() const {
+    return forkDepth < cutoff;
+}
+
+void ParallelEval::poll() const {
+    if (cancelled(job)) throw Abandoned();
+}
+
+size_t ParallelEval::evalAll(const std::vector<Node*>& args, Environment* env, Value* out, TempRoots& held,
+                             std::exception_ptr& error, bool numbers) {
+    // Tasks this thread helps with may leave it frames of other runtimes
+    runtime->heap.shareObjects();
+    Fork fork(args, env, numbers);
+    for (size_t i = 1; i < args.size(); ++i) {
+        Fork* f = &fork;
+        pool->submit([f, i] {
+            runTask(*f, i);
+            f->left--;
+        });
+    }
+
+    // The first operand here, straight into `out`
+    bool failed = false;
+    int outerDepth = forkDepth;
+    forkDepth = fork.depth;
+    Job first = {&fork, 0, fork.outer};
+    const Job* outerJob = job;
+    job = &first;
+    try {
+        out[0] = args[0]->eval(env);
+        held.keep(out[0]);
+        if (numbers && !out[0].isNumber()) fork.fail(0);
+    } catch (...) {
+        error = std::current_exception();
+        failed = true;
+        fork.fail(0);
+    }
+    job = outerJob;
+    forkDepth = outerDepth;
+    // Tasks after a failed operand give up at their next call
+    while (fork.left > 0) {
+        if (!pool->runPending()) std::this_thread::yield();
+    }
+    if (failed) return 0;
+    if (numbers && !out[0].isNumber()) return 1;
+
+    for (size_t i = 1; i < args.size(); ++i) {
+        Operand& operand = fork.operands[i];
+        if (operand.error) {
+            error = operand.error;
+            return i;
+        }
+        if (operand.bignum) {
+            out[i] = importNumber(operand.negative, operand.limbs.data(), uint32_t(operand.limbs.size()));
+        } else if (operand.rerun) {
+            out[i] = args[i]->eval(env);
+        } else {
+            out[i] = operand.value;
+        }
+        held.keep(out[i]);
+        if (numbers && !out[i].isNumber()) return i + 1;
+    }
+    return args.size();
+}
+
+void ParallelEval::evalInto(const std::vector<Node*>& args, Environment* env, Value* out) {
+    TempRoots held;
+    std::exception_ptr error;
+    if (evalAll(args, env, out, held, error) < args.size()) std::rethrow_exception(error);
+}
+
+bool ParallelEval::markCalls(Node* node) {
+    if (auto call = dynamic_cast<CallNode*>(node)) {
+        markCalls(call->funcExp);
+        int calling = 0;
+        for (Node* arg : call->args) calling += markCalls(arg);
+        call->fork = calling >= 2;
+        return true;
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        int calling = 0;
+        for (Node* arg : op->args) calling += markCalls(arg);
+        // Not the operators that stop at an operand that decides the
+        // result: evaluating the rest may not even end
+        bool shortCircuits = op->op == OpCode::EQUAL || op->op == OpCode::AND || op->op == OpCode::OR;
+        op->fork = calling >= 2 && (strictEval || !shortCircuits);
+        return calling > 0;
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        // Making the closure calls nothing
+        markCalls(fun->body);
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        bool test = markCalls(ifn->testExp);
+        bool then = markCalls(ifn->thenExp);
+        bool otherwise = markCalls(ifn->elseExp);
+        return test || then || otherwise;
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        markCalls(print->exp);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        return markCalls(def->exp);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        bool calls = false;
+        for (Node* stmt : block->stmts) calls |= markCalls(stmt);
+        return calls;
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <vector>
+#include "ast.h"
+#include "pool.h"
+
+class TempRoots;
+
+// Fork-join evaluation of independent operands for --parallel (tree walker
+// only). Function bodies cannot print and nothing can be mutated, so the
+// operands of a call or an arithmetic operator are independent and may be
+// evaluated at the same time; print-num/print-bool are statements, so every
+// fork has joined before the statement around it prints, and output keeps
+// its program order.
+//
+// mark() flags the calls and operators with at least two operands that make
+// calls (CallNode::fork, BinaryOpNode::fork); the others are too cheap to be
+// worth a task. Such a node forks while the thread is fewer than `cutoff`
+// forks deep, so a recursion like fib forks only near the root and runs
+// sequentially below. The forking thread evaluates the first operand
+// itself, the rest become tasks of a work-stealing pool, and while it waits
+// for them it runs queued tasks instead of blocking.
+//
+// A task runs on the runtime of the thread that takes it: the forker's own,
+// or one per pool worker. An environment is therefore never written by two
+// threads: the frames a task reads belong to a forker, which stays in the
+// join until the task is done and keeps them alive, and every frame a task
+// makes belongs to the runtime it runs on. Such heaps mark only their own
+// objects (Heap::shareObjects). Results cross as numbers and booleans, a
+// bignum copied into the forker's heap; an operand that turns out to be a
+// function (a closure of the taking runtime) is evaluated again by the
+// forker. Errors are reported as sequential evaluation would have: the
+// first operand that fails, after every task has finished. The operands
+// after one that failed are not needed, and might not even end where
+// sequential evaluation never started them: their tasks, and the forks
+// nested in them, give up at the next call (poll).
+//
+// Process-wide, like --strict; not for --memoize, --profile or the VM,
+// whose tables are per thread or not thread safe.
+class ParallelEval {
+public:
+    // Start a pool for `threads` threads evaluating at once, the forking
+    // one included
+    void start(unsigned threads);
+    bool enabled() const { return pool != nullptr; }
+
+    // Set the fork flags of `node` and everything in it
+    void mark(Node* node) { markCalls(node); }
+
+    bool shouldFork() const;
+
+    // Evaluate `args` in `env` into `out` at the same time. Returns how many
+    // leading operands evaluated; when that is not all of them, `error` is
+    // what the next one threw. With `numbers`, an operand that is not a
+    // number fails too, being a type error for the operator: it is the last
+    // one counted and `error` is left empty. Bignums in `out` are kept in
+    // `held`.
+    size_t evalAll(const std::vector<Node*>& args, Environment* env, Value* out, TempRoots& held,
+                   std::exception_ptr& error, bool numbers = false);
+
+    // evalAll for the arguments of a call, throwing the first error
+    void evalInto(const std::vector<Node*>& args, Environment* env, Value* out);
+
+    // Give up the operand this thread evaluates when an earlier operand of
+    // its fork, or of a fork it is nested in, failed. CallNode::enter calls
+    // it while enabled.
+    void poll() const;
+
+private:
+    std::unique_ptr<ThreadPool> pool;
+    int cutoff = 0;
+
+    // Whether `node` makes a call when evaluated
+    bool markCalls(Node* node);
+};
+
+extern ParallelEval parallel;
+
+#endif
@@ -0,0 +1,25 @@
+#include "parse.h"
+
+#include "source.h"
+#include "parser.tab.h"
+#include "lex.yy.h"
+#include "runtime.h"
+
+void parseSource(SourceBuffer& source, ParseState& state) {
+    yyscan_t scanner;
+    yylex_init(&scanner);
+    // The buffer ends in the two NULs flex expects, so it is scanned in place
+    YY_BUFFER_STATE buffer = yy_scan_buffer(source.data(), source.size() + 2, scanner);
+    int failed;
+    try {
+        failed = yyparse(scanner, &state);
+    } catch (...) {
+        // With --stream, an error of a statement run by the parser
+        yy_delete_buffer(buffer, scanner);
+        yylex_destroy(scanner);
+        throw;
+    }
+    yy_delete_buffer(buffer, scanner);
+    yylex_destroy(scanner);
+    if (failed) throw ProgramError{"syntax error", false, 0};
+}
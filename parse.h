@@ -0,0 +1,22 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <vector>
+#include "ast.h"
+
+class SourceBuffer;
+
+// State of one parse. The scanner (reentrant flex) and the parser (pure
+// bison) keep everything else on their own stacks, so several sources can
+// be parsed at the same time.
+struct ParseState {
+    std::vector<Node*> program; // Top-level statements, in order
+    // When set (--stream), each top-level statement is handed over as soon
+    // as it is parsed instead of being collected in `program`
+    void (*onStatement)(Node* stmt) = nullptr;
+};
+
+// Parse the whole source; a syntax error throws a ProgramError (see yyerror)
+void parseSource(SourceBuffer& source, ParseState& state);
+
+#endif
@@ -1,30 +1,37 @@
-%{
-#include <iostream>
-#include <vector>
+%code requires {
 #include <string>
+#include <vector>
 #include "ast.h"
+#include "parse.h"
+
+typedef void* yyscan_t;
+}
 
-extern "C" int yylex();
-extern "C" int yyparse();
-extern "C" FILE* yyin;
-void yyerror(const char* s);
+%code {
+int yylex(YYSTYPE* lvalp, yyscan_t scanner);
+void yyerror(yyscan_t scanner, ParseState* state, const char* s);
 
-// Global list of statements to execute
-std::vector<Node*> program;
-%}
+static void statement(ParseState* state, Node* stmt) {
+    if (state->onStatement) state->onStatement(stmt);
+    else state->program.push_back(stmt);
+}
+}
+
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {ParseState* state}
 
 %union {
-    int ival;
     bool bval;
-    std::string* sval;
+    Symbol sym;
     Node* node;
     std::vector<Node*>* nodes;
-    std::vector<std::string>* ids;
+    std::vector<Symbol>* ids;
 }
 
-%token <ival> NUMBER
+%token <node> NUMBER
 %token <bval> BOOL_VAL
-%token <sval> ID
+%token <sym> ID
 %token PRINT_NUM PRINT_BOOL
 %token PLUS MINUS MULTIPLY DIVIDE MODULUS GREATER SMALLER EQUAL
 %token AND OR NOT
@@ -35,13 +42,17 @@ std::vector<Node*> program;
 %type <nodes> EXPS PARAM DEF_STMTS
 %type <ids> FUN_IDS IDS
 
+// Free what was parsed so far when a syntax error aborts the parse
+%destructor { delete $$; } <node> <ids>
+%destructor { for (Node* n : *$$) delete n; delete $$; } <nodes>
+
 %%
 
 PROGRAM : STMTS
         ;
 
-STMTS : STMT { program.push_back($1); }
-      | STMTS STMT { program.push_back($2); }
+STMTS : STMT { statement(state, $1); }
+      | STMTS STMT { statement(state, $2); }
       ;
 
 STMT : EXP
@@ -54,8 +65,8 @@ PRINT_STMT : LPAREN PRINT_NUM EXP RPAREN { $$ = new PrintNode(true, $3); }
            ;
 
 EXP : BOOL_VAL { $$ = new BoolNode($1); }
-    | NUMBER { $$ = new NumberNode($1); }
-    | ID { $$ = new VariableNode(*$1); delete $1; }
+    | NUMBER { $$ = $1; }
+    | ID { $$ = new VariableNode($1); }
     | NUM_OP
     | LOGICAL_OP
     | FUN_EXP
@@ -63,51 +74,51 @@ EXP : BOOL_VAL { $$ = new BoolNode($1); }
     | IF_EXP
     ;
 
-NUM_OP : LPAREN PLUS EXPS RPAREN { $$ = new BinaryOpNode("+", *$3); delete $3; }
+NUM_OP : LPAREN PLUS EXPS RPAREN { $$ = new BinaryOpNode(OpCode::ADD, *$3); delete $3; }
        | LPAREN MINUS EXP EXP RPAREN { 
             std::vector<Node*> args; args.push_back($3); args.push_back($4);
-            $$ = new BinaryOpNode("-", args); 
+            $$ = new BinaryOpNode(OpCode::SUB, args); 
        }
-       | LPAREN MULTIPLY EXPS RPAREN { $$ = new BinaryOpNode("*", *$3); delete $3; }
+       | LPAREN MULTIPLY EXPS RPAREN { $$ = new BinaryOpNode(OpCode::MUL, *$3); delete $3; }
        | LPAREN DIVIDE EXP EXP RPAREN { 
             std::vector<Node*> args; args.push_back($3); args.push_back($4);
-            $$ = new BinaryOpNode("/", args); 
+            $$ = new BinaryOpNode(OpCode::DIV, args); 
        }
        | LPAREN MODULUS EXP EXP RPAREN { 
             std::vector<Node*> args; args.push_back($3); args.push_back($4);
-            $$ = new BinaryOpNode("mod", args); 
+            $$ = new BinaryOpNode(OpCode::MOD, args); 
        }
        | LPAREN GREATER EXP EXP RPAREN { 
             std::vector<Node*> args; args.push_back($3); args.push_back($4);
-            $$ = new BinaryOpNode(">", args); 
+            $$ = new BinaryOpNode(OpCode::GREATER, args); 
        }
        | LPAREN SMALLER EXP EXP RPAREN { 
             std::vector<Node*> args; args.push_back($3); args.push_back($4);
-            $$ = new BinaryOpNode("<", args); 
+            $$ = new BinaryOpNode(OpCode::SMALLER, args); 
        }
-       | LPAREN EQUAL EXPS RPAREN { $$ = new BinaryOpNode("=", *$3); delete $3; }
+       | LPAREN EQUAL EXPS RPAREN { $$ = new BinaryOpNode(OpCode::EQUAL, *$3); delete $3; }
        ;
 
-LOGICAL_OP : LPAREN AND EXPS RPAREN { $$ = new BinaryOpNode("and", *$3); delete $3; }
-           | LPAREN OR EXPS RPAREN { $$ = new BinaryOpNode("or", *$3); delete $3; }
+LOGICAL_OP : LPAREN AND EXPS RPAREN { $$ = new BinaryOpNode(OpCode::AND, *$3); delete $3; }
+           | LPAREN OR EXPS RPAREN { $$ = new BinaryOpNode(OpCode::OR, *$3); delete $3; }
            | LPAREN NOT EXP RPAREN { 
                 std::vector<Node*> args; args.push_back($3);
-                $$ = new BinaryOpNode("not", args); 
+                $$ = new BinaryOpNode(OpCode::NOT, args); 
            }
            ;
 
-DEF_STMT : LPAREN DEFINE ID EXP RPAREN { $$ = new DefineNode(*$3, $4); delete $3; }
+DEF_STMT : LPAREN DEFINE ID EXP RPAREN { $$ = new DefineNode($3, $4); }
          ;
 
 FUN_EXP : LPAREN FUN FUN_IDS FUN_BODY RPAREN { $$ = new FunNode(*$3, $4); delete $3; }
         ;
 
-FUN_IDS : LPAREN RPAREN { $$ = new std::vector<std::string>(); }
+FUN_IDS : LPAREN RPAREN { $$ = new std::vector<Symbol>(); }
         | LPAREN IDS RPAREN { $$ = $2; }
         ;
 
-IDS : ID { $$ = new std::vector<std::string>(); $$->push_back(*$1); delete $1; }
-    | IDS ID { $$ = $1; $$->push_back(*$2); delete $2; }
+IDS : ID { $$ = new std::vector<Symbol>(); $$->push_back($1); }
+    | IDS ID { $$ = $1; $$->push_back($2); }
     ;
 
 FUN_BODY : EXP { $$ = $1; }
@@ -126,7 +137,7 @@ FUN_CALL : LPAREN FUN_EXP PARAM RPAREN {
              $$ = new CallNode($2, *$3); delete $3; 
          }
          | LPAREN ID PARAM RPAREN {
-             $$ = new CallNode(new VariableNode(*$2), *$3); delete $3; delete $2;
+             $$ = new CallNode(new VariableNode($2), *$3); delete $3;
          }
          ;
 
@@ -143,7 +154,6 @@ EXPS : EXP { $$ = new std::vector<Node*>(); $$->push_back($1); }
 
 %%
 
-void yyerror(const char* s) {
-    std::cout << "syntax error" << std::endl;
-    exit(0);
+void yyerror(yyscan_t scanner, ParseState* state, const char* s) {
+    // Reported by parseSource once the parser has cleaned up
 }
\ No newline at end of file
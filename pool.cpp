@@ -0,0 +1,133 @@
+#include "pool.h"
+
+#include <system_error>
+#include "runtime.h"
+
+// Pool and queue of the worker running on this thread
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+struct ThreadPool::Start {
+    ThreadPool* pool;
+    size_t self;
+};
+
+ThreadPool::ThreadPool(unsigned workers) {
+    if (workers == 0) workers = 1;
+    for (unsigned i = 0; i < workers; ++i) queues.emplace_back(new Queue);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, threadStackSize());
+    for (unsigned i = 0; i < workers; ++i) {
+        pthread_t thread;
+        Start* start = new Start{this, i};
+        if (int failed = pthread_create(&thread, &attr, &ThreadPool::run, start)) {
+            delete start;
+            // As std::thread would
+            if (threads.empty()) {
+                pthread_attr_destroy(&attr);
+                throw std::system_error(failed, std::generic_category(), "Cannot start a worker");
+            }
+            break;
+        }
+        threads.push_back(thread);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (pthread_t thread : threads) pthread_join(thread, nullptr);
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    size_t target = currentPool == this ? currentWorker : next++ % queues.size();
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ++queued;
+        ++pending;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return pending == 0; });
+}
+
+bool ThreadPool::runPending() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (queued == 0) return false;
+        --queued;
+    }
+    // As in work(): the task counted is in some queue
+    size_t self = currentPool == this ? currentWorker : 0;
+    std::function<void()> task;
+    while (!take(self, task)) std::this_thread::yield();
+    task();
+    task = nullptr;
+    std::lock_guard<std::mutex> guard(lock);
+    if (--pending == 0) idle.notify_all();
+    return true;
+}
+
+// Pop the newest task of our own queue, or steal the oldest of another
+bool ThreadPool::take(size_t self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& other = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(other.lock);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void* ThreadPool::run(void* arg) {
+    Start start = *static_cast<Start*>(arg);
+    delete static_cast<Start*>(arg);
+    limitStack(threadStackSize());
+    start.pool->work(start.self);
+    return nullptr;
+}
+
+void ThreadPool::work(size_t self) {
+    currentPool = this;
+    currentWorker = self;
+    std::function<void()> task;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return stopping || queued > 0; });
+            if (queued == 0) return; // Stopping and nothing left
+            --queued;
+        }
+        // The task counted above is in some queue until somebody takes it,
+        // so keep looking until we are the one who does
+        while (!take(self, task)) std::this_thread::yield();
+        task();
+        task = nullptr;
+        std::lock_guard<std::mutex> guard(lock);
+        if (--pending == 0) idle.notify_all();
+    }
+}
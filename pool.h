@@ -0,0 +1,66 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Each worker has its own queue: a task submitted
+// from a worker goes to the back of that worker's queue and is taken from
+// the back again, other tasks are spread over the queues, and an idle worker
+// steals from the front of the others.
+//
+// Workers are pthreads with a stack of threadStackSize() (runtime.h), which
+// std::thread cannot be given: tasks evaluate programs, which recurse on
+// it, and each worker limits calls to it (limitStack) so a deep recursion
+// fails with an error as on the main thread.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned workers);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    // Block until every submitted task has finished
+    void wait();
+
+    // Run one queued task on the calling thread; false when there is none.
+    // For a thread waiting on tasks it submitted, which can help with them
+    // (or whatever else is queued) instead of blocking.
+    bool runPending();
+
+    size_t size() const { return threads.size(); }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<pthread_t> threads;
+    std::atomic<size_t> next{0};   // Queue of the next task from outside
+
+    std::mutex lock;               // Guards the counters below
+    std::condition_variable wake;  // A task was submitted, or stopping
+    std::condition_variable idle;  // pending dropped to zero
+    size_t queued = 0;             // Tasks in some queue
+    size_t pending = 0;            // Tasks submitted and not yet finished
+    bool stopping = false;
+
+    struct Start;
+    static void* run(void* start);
+    void work(size_t self);
+    bool take(size_t self, std::function<void()>& task);
+};
+
+#endif
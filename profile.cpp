@@ -0,0 +1,96 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+Profiler profiler;
+
+void Profiler::start(const std::string& path) {
+    on = true;
+    foldedPath = path;
+    paths.push_back(Path{-1, -1, 0});
+}
+
+int Profiler::functionId(FunNode* fun) {
+    if (fun->profileId < 0) {
+        fun->profileId = int(functions.size());
+        functions.push_back(Function());
+        // Tell apart functions that share a name, such as two lambdas in f
+        int& seen = nameCount[fun->name];
+        functions.back().name = ++seen == 1 ? fun->name : fun->name + "#" + std::to_string(seen);
+    }
+    return fun->profileId;
+}
+
+int Profiler::childPath(int parent, int function) {
+    uint64_t edge = (uint64_t(uint32_t(parent)) << 32) | uint32_t(function);
+    auto it = children.find(edge);
+    if (it != children.end()) return it->second;
+    paths.push_back(Path{parent, function, 0});
+    return children[edge] = int(paths.size() - 1);
+}
+
+void Profiler::enter(FunNode* fun) {
+    int id = functionId(fun);
+    int parent = stack.empty() ? 0 : stack.back().path;
+    Function& f = functions[id];
+    f.calls++;
+    if (++f.depth > f.maxDepth) f.maxDepth = f.depth;
+    stack.push_back(Activation{id, childPath(parent, id), Clock::now(), 0});
+}
+
+void Profiler::tailCall(FunNode* fun) {
+    leave();
+    enter(fun);
+}
+
+void Profiler::leave() {
+    Activation a = stack.back();
+    stack.pop_back();
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - a.start).count();
+    Function& f = functions[a.function];
+    if (--f.depth == 0) f.inclusive += elapsed;
+    f.exclusive += elapsed - a.callees;
+    paths[a.path].self += elapsed - a.callees;
+    if (!stack.empty()) stack.back().callees += elapsed;
+}
+
+void Profiler::finish(std::ostream& os) {
+    while (!stack.empty()) leave();
+
+    std::vector<const Function*> order;
+    for (const Function& f : functions) order.push_back(&f);
+    std::stable_sort(order.begin(), order.end(), [](const Function* a, const Function* b) {
+        return a->exclusive > b->exclusive;
+    });
+
+    os << "Profile (times in ms):" << std::endl
+       << std::left << std::setw(24) << "  function" << std::right
+       << std::setw(12) << "calls" << std::setw(14) << "inclusive"
+       << std::setw(14) << "exclusive" << std::setw(11) << "max depth" << std::endl;
+    for (const Function* f : order) {
+        os << "  " << std::left << std::setw(22) << f->name << std::right
+           << std::setw(12) << f->calls << std::fixed << std::setprecision(3)
+           << std::setw(14) << f->inclusive / 1e6 << std::setw(14) << f->exclusive / 1e6
+           << std::setw(11) << f->maxDepth << std::endl;
+    }
+
+    writeFolded();
+    os << "Folded stacks written to " << foldedPath << std::endl;
+}
+
+void Profiler::writeFolded() const {
+    // One "main;f;g <microseconds>" line per call path, as flamegraph.pl reads them
+    std::ofstream out(foldedPath);
+    std::vector<int> chain;
+    for (size_t i = 1; i < paths.size(); ++i) {
+        int64_t us = paths[i].self / 1000;
+        if (us <= 0) continue;
+        chain.clear();
+        for (int p = int(i); p > 0; p = paths[p].parent) chain.push_back(paths[p].function);
+        out << "main";
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) out << ';' << functions[*it].name;
+        out << ' ' << us << '\n';
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+// Call profiler for --profile. Both engines report every call that runs a
+// function body (a --memoize hit runs none and is not counted):
+//   - enter() when the body starts,
+//   - tailCall() when a tail call replaces it, which ends the activation
+//     and starts the callee's in the same place of the call tree,
+//   - leave() when the last body of the chain returns.
+// Functions are named after the define they are bound to (FunNode::name).
+//
+// Inclusive time counts only the outermost activation of a function, so
+// recursion is not counted twice; exclusive time leaves out the callees.
+// Max depth is the most activations of a function live at once, which a
+// tail-recursive loop keeps at 1. When profiling is off the engines only
+// test enabled().
+class Profiler {
+public:
+    bool enabled() const { return on; }
+
+    // Start profiling; the folded stacks are written to `foldedPath`
+    void start(const std::string& foldedPath);
+
+    void enter(FunNode* fun);
+    void tailCall(FunNode* fun);
+    void leave();
+
+    // Close the activations still open (the program may have stopped on an
+    // error), print the flat report to `os` and write the folded stacks
+    void finish(std::ostream& os);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Function {
+        std::string name;
+        size_t calls = 0;
+        int64_t inclusive = 0; // Nanoseconds
+        int64_t exclusive = 0;
+        int depth = 0;
+        int maxDepth = 0;
+    };
+
+    // A node of the call tree; the folded output has one line per node
+    struct Path {
+        int parent;
+        int function;
+        int64_t self;
+    };
+
+    struct Activation {
+        int function;
+        int path;
+        Clock::time_point start;
+        int64_t callees; // Nanoseconds spent in callees
+    };
+
+    bool on = false;
+    std::string foldedPath;
+    std::vector<Function> functions;
+    std::unordered_map<std::string, int> nameCount;
+    std::vector<Path> paths; // paths[0] is the top level
+    std::unordered_map<uint64_t, int> children; // (parent path, function) -> path
+    std::vector<Activation> stack;
+
+    int functionId(FunNode* fun);
+    int childPath(int parent, int function);
+    void writeFolded() const;
+};
+
+extern Profiler profiler;
+
+#endif
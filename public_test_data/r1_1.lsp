@@ -0,0 +1,3 @@
+(define inf (fun (x) (inf x)))
+(define g (fun (x) (+ x 1)))
+(print-num (+ (g #t) (inf 1)))
@@ -0,0 +1,4 @@
+(define inf (fun (x) (inf x)))
+(define g (fun (x) (+ x 1)))
+(define h (fun (a b) (+ a b)))
+(print-num (h (g #t) (inf 1)))
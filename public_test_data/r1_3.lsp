@@ -0,0 +1,4 @@
+(define id (fun (x) x))
+(define g (fun (x) (/ x -2)))
+(define h (fun (x) (mod x 0)))
+(print-num (+ (id 1) (g #f) (h 1) (id 2)))
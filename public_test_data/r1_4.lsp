@@ -0,0 +1,4 @@
+(define bad-div (fun (x) (/ x -2)))
+(define bad-mod (fun (x) (mod x 0)))
+(define f (fun (a b c) (+ a b c)))
+(print-num (f (bad-div 4) (bad-mod 1) (bad-div #f)))
@@ -0,0 +1,23 @@
+(define fact
+  (fun (n) (if (< n 2) 1 (* n (fact (- n 1))))))
+
+(define pow2
+  (fun (n) (if (= n 0) 1 (* 2 (pow2 (- n 1))))))
+
+(define max-fix (- (pow2 60) 1))
+
+(print-num (fact 20))
+(print-num (fact 21))
+(print-num (fact 25))
+(print-num max-fix)
+(print-num (+ max-fix 1))
+(print-num (+ max-fix max-fix))
+(print-num (- (- 0 max-fix) 1))
+(print-num (- (- 0 max-fix) 2))
+(print-num (* max-fix max-fix))
+(print-num (* (- 0 (pow2 40)) (pow2 40)))
+(print-num (+ 1 2 3 max-fix 4 5))
+(print-num (pow2 100))
+(print-bool (> (pow2 61) max-fix))
+(print-bool (< (- 0 (pow2 61)) (- 0 max-fix)))
+(print-bool (= (pow2 64) (* (pow2 32) (pow2 32))))
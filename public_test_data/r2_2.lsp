@@ -0,0 +1,18 @@
+(define pow2
+  (fun (n) (if (= n 0) 1 (* 2 (pow2 (- n 1))))))
+
+(define big (pow2 80))
+
+(print-num (- (+ big 7) big))
+(print-num (- big (- big 1)))
+(print-num (/ big (pow2 70)))
+(print-num (/ (* big 3) big))
+(print-num (mod (+ big 5) (pow2 40)))
+(print-num (mod (- (- 0 big) 5) (pow2 40)))
+(print-num (/ (- 0 big) (pow2 79)))
+(print-num (+ (* big -1) big 42))
+(print-num (* (/ big (pow2 60)) (/ big (pow2 60))))
+(print-bool (= (- (+ big 7) big) 7))
+(print-bool (= (/ big big) 1))
+(print-num (+ (- (+ big 7) big) 1))
+(print-num (- (/ big (pow2 79)) 2))
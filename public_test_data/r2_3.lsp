@@ -0,0 +1,2 @@
+(print-num (mod 100000000000000000000000000 7))
+(print-num (mod 100000000000000000000000000 0))
@@ -0,0 +1,7 @@
+(define pow2
+  (fun (n) (if (= n 0) 1 (* 2 (pow2 (- n 1))))))
+
+(define big (pow2 80))
+
+(print-num (/ big (pow2 78)))
+(print-num (/ big (- big big)))
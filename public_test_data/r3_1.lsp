@@ -0,0 +1,17 @@
+(define parity
+  (fun (n)
+    (define is-even (fun (k) (if (= k 0) #t (is-odd (- k 1)))))
+    (define is-odd (fun (k) (if (= k 0) #f (is-even (- k 1)))))
+    (is-even n)))
+
+(print-bool (parity 10))
+(print-bool (parity 7))
+
+(define scaled
+  (fun (x)
+    (define twice (fun (y) (* factor y 2)))
+    (define factor (+ x 1))
+    (twice x)))
+
+(print-num (scaled 3))
+(print-num (scaled 10))
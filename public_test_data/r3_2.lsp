@@ -0,0 +1,22 @@
+(define sum-to
+  (fun (n)
+    (define loop (fun (i acc) (if (> i n) acc (loop (+ i 1) (+ acc i)))))
+    (loop 1 0)))
+
+(print-num (sum-to 10))
+(print-num (sum-to 100000))
+
+(define count-digits
+  (fun (n base)
+    (define digits (fun (m) (if (< m base) 1 (+ 1 (digits (/ m base))))))
+    (digits n)))
+
+(print-num (count-digits 1000 10))
+(print-num (count-digits 255 2))
+
+(define fib
+  (fun (n)
+    (define go (fun (k) (if (< k 2) k (+ (go (- k 1)) (go (- k 2))))))
+    (go n)))
+
+(print-num (fib 20))
@@ -0,0 +1,35 @@
+(define make-counter
+  (fun (start step)
+    (define next (+ start step))
+    (fun (k) (+ next (* k step)))))
+
+(define c1 (make-counter 10 5))
+(define c2 (make-counter 100 1))
+
+(print-num (c1 0))
+(print-num (c1 3))
+(print-num (c2 3))
+(print-num (c1 1))
+
+(define compose
+  (fun (f g) (fun (x) (f (g x)))))
+
+(define add (fun (a) (fun (b) (+ a b))))
+(define mul (fun (a) (fun (b) (* a b))))
+
+(define add3-then-double (compose (mul 2) (add 3)))
+(print-num (add3-then-double 4))
+(define times10-plus1 (compose (add 1) (mul 10)))
+(print-num (times10-plus1 4))
+
+(define outer
+  (fun (a)
+    (fun (b)
+      (fun (c) (- (* a 100) (+ (* b 10) c))))))
+
+(define o1 (outer 9))
+(define o2 (o1 8))
+(print-num (o2 7))
+(define o3 (o1 1))
+(print-num (o3 2))
+(print-num (o2 0))
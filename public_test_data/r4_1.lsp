@@ -0,0 +1,3 @@
+(print-num (mod 7 3))
+(print-num (mod -7 3))
+(print-num (mod 1 0))
@@ -0,0 +1,9 @@
+(define m (fun (a b) (mod a b)))
+
+(define loop
+  (fun (i acc)
+    (if (= i 0) acc (loop (- i 1) (+ acc (m i 7))))))
+
+(print-num (loop 5000 0))
+(define zero (- 5 5))
+(print-num (m 10 zero))
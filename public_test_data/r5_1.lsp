@@ -0,0 +1,4 @@
+(define deep (fun (n) (if (= n 0) 0 (+ 1 (deep (- n 1))))))
+
+(print-num (deep 2000))
+(print-num (deep 1000000))
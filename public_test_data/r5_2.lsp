@@ -0,0 +1,8 @@
+(define sum (fun (n) (if (= n 0) 0 (add n (sum (- n 1))))))
+(define add (fun (a b) (+ a b)))
+
+(define loop (fun (n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1)))))
+
+(print-num (loop 1000000 0))
+(print-num (sum 2000))
+(print-num (sum 1000000))
@@ -0,0 +1,198 @@
+#include "resolver.h"
+
+#include <climits>
+
+int Resolver::Scope::declare(Symbol name) {
+    auto it = slots.find(name);
+    if (it != slots.end()) {
+        return it->second; // Redefinition is reported when the define runs
+    }
+    slots[name] = size;
+    return size++;
+}
+
+Resolver::Resolver() : globals(nullptr) {}
+
+void Resolver::resolve(Node* stmt) {
+    resolveNode(stmt, &globals);
+    convert(stmt, nullptr);
+    freeVars.clear();
+}
+
+bool Resolver::lookup(VariableNode* var, Scope* scope) {
+    int depth = 0;
+    for (Scope* s = scope; s; s = s->parent, ++depth) {
+        auto it = s->slots.find(var->name);
+        if (it != s->slots.end()) {
+            var->depth = depth;
+            var->slot = it->second;
+            // A free variable of every function in between
+            for (Scope* inner = scope; s->parent && inner != s; inner = inner->parent) {
+                std::vector<Capture>& free = freeVars[inner->fun];
+                bool seen = false;
+                for (const Capture& c : free) seen |= c.level == s->level && c.slot == var->slot;
+                if (!seen) free.push_back(Capture{s->level, var->slot, var->name});
+            }
+            return !s->parent;
+        }
+        if (!s->parent) {
+            // Unknown names become (still undefined) globals
+            var->depth = depth;
+            var->slot = s->declare(var->name);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Resolver::resolveNode(Node* node, Scope* scope) {
+    if (auto var = dynamic_cast<VariableNode*>(node)) {
+        lookup(var, scope);
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        for (Node* arg : op->args) resolveNode(arg, scope);
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        resolveNode(ifn->testExp, scope);
+        resolveNode(ifn->thenExp, scope);
+        resolveNode(ifn->elseExp, scope);
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        resolveNode(print->exp, scope);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        def->slot = scope->declare(def->name);
+        if (auto fun = dynamic_cast<FunNode*>(def->exp)) fun->name = symbols.name(def->name);
+        resolveNode(def->exp, scope);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (Node* stmt : block->stmts) resolveNode(stmt, scope);
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        funsSeen++;
+        if (fun->name.empty()) fun->name = enclosing.empty() ? "lambda" : enclosing + "/lambda";
+        std::string outer = enclosing;
+        enclosing = fun->name;
+        Scope local(scope);
+        local.fun = fun;
+        local.level = scope->level + 1;
+        for (Symbol p : fun->params) {
+            // A repeated parameter name refers to the last one, as before
+            local.slots[p] = local.size++;
+        }
+        // Inner defines belong to the whole body, not just what follows them
+        if (auto body = dynamic_cast<BlockNode*>(fun->body)) {
+            for (Node* stmt : body->stmts) {
+                if (auto def = dynamic_cast<DefineNode*>(stmt)) local.declare(def->name);
+            }
+        }
+        resolveNode(fun->body, &local);
+        fun->frameSize = local.size;
+        enclosing = outer;
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        auto callee = dynamic_cast<VariableNode*>(call->funcExp);
+        if (!callee) {
+            resolveNode(call->funcExp, scope);
+        } else if (lookup(callee, scope)) {
+            call->site = callSites++;
+        }
+        for (Node* arg : call->args) resolveNode(arg, scope);
+    }
+    // NumberNode and BoolNode need nothing
+}
+
+void Resolver::address(Closure* closure, int level, int slot, VariableNode* var) {
+    int depth = 0;
+    for (Closure* c = closure; c && c->level != level; c = c->parent) {
+        FunNode* fun = c->fun;
+        if (!fun->capturesFrame) {
+            if (level == 0) {
+                var->depth = depth + fun->globalDepth();
+                var->slot = slot;
+                return;
+            }
+            // In the record, which holds every free variable
+            int index = 0;
+            while (c->free[index].level != level || c->free[index].slot != slot) ++index;
+            var->depth = depth + 1;
+            var->slot = index;
+            return;
+        }
+        ++depth; // The frame it was made in
+    }
+    var->depth = depth;
+    var->slot = slot;
+}
+
+// Runs once the whole statement is resolved, so that every function's
+// free variables are known before the functions around it are converted
+void Resolver::convert(Node* node, Closure* closure) {
+    if (auto var = dynamic_cast<VariableNode*>(node)) {
+        int level = closure ? closure->level : 0;
+        address(closure, level - var->depth, var->slot, var);
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        for (Node* arg : op->args) convert(arg, closure);
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        convert(ifn->testExp, closure);
+        convert(ifn->thenExp, closure);
+        convert(ifn->elseExp, closure);
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        convert(print->exp, closure);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        if (auto fun = dynamic_cast<FunNode*>(def->exp)) {
+            convertFun(fun, closure, def->slot);
+        } else {
+            convert(def->exp, closure);
+        }
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (Node* stmt : block->stmts) convert(stmt, closure);
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        convertFun(fun, closure, -1);
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        convert(call->funcExp, closure);
+        for (Node* arg : call->args) convert(arg, closure);
+    }
+}
+
+void Resolver::convertFun(FunNode* fun, Closure* parent, int selfSlot) {
+    Closure closure;
+    closure.fun = fun;
+    closure.parent = parent;
+    closure.level = parent ? parent->level + 1 : 1;
+    closure.stmt = 0;
+    auto it = freeVars.find(fun);
+    if (it != freeVars.end()) closure.free.swap(it->second);
+
+    // A function at the top level has no free variables
+    bool late = false;
+    for (const Capture& c : closure.free) {
+        if (c.level != parent->level) {
+            // Copied from the parent's record, unless it has none
+            late |= parent->fun->capturesFrame;
+        } else if (c.slot >= int(parent->fun->params.size()) && c.slot != selfSlot) {
+            late |= parent->definedAt[c.slot] >= parent->stmt;
+        }
+    }
+    fun->capturesFrame = late;
+    fun->outerDepth = parent ? parent->fun->globalDepth() : 0;
+    fun->frameEscapes = false;
+    if (late) {
+        parent->fun->frameEscapes = true;
+    } else {
+        for (size_t i = 0; i < closure.free.size(); ++i) {
+            const Capture& c = closure.free[i];
+            VariableNode* var = new VariableNode(c.name);
+            address(parent, c.level, c.slot, var);
+            fun->captures.push_back(var);
+            if (c.level == parent->level && c.slot == selfSlot) fun->selfCapture = int(i);
+        }
+    }
+
+    closure.definedAt.assign(fun->frameSize, INT_MAX);
+    if (auto body = dynamic_cast<BlockNode*>(fun->body)) {
+        for (size_t i = 0; i < body->stmts.size(); ++i) {
+            auto def = dynamic_cast<DefineNode*>(body->stmts[i]);
+            if (def && closure.definedAt[def->slot] == INT_MAX) closure.definedAt[def->slot] = int(i);
+        }
+        for (Node* stmt : body->stmts) {
+            convert(stmt, &closure);
+            ++closure.stmt;
+        }
+    } else {
+        convert(fun->body, &closure);
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+// Lexical addressing pass, run after yyparse() and before evaluation.
+// Every VariableNode gets the number of frames to walk up and the slot it
+// lives in, every DefineNode the slot it fills, and every FunNode the size
+// of the frame a call allocates.
+//
+// A function frame holds its parameters followed by the defines of its body,
+// so an inner define is visible to the whole body. Names that are not bound
+// by any enclosing function are global: the top-level table hands out a
+// slot per distinct name, whether the define has been seen yet or not, and
+// the run-time "not defined" check catches references that never get one.
+// Functions are named after their define; a lambda is named after the
+// function it appears in ("f/lambda"). A call of a global variable gets
+// the next call site number (CallNode::site) for its inline cache.
+//
+// Closure conversion follows. Bindings never change once defined, so a
+// closure can copy the variables of the enclosing functions its body uses
+// (its free variables) into a flat record, read at depth 1, and reach
+// globals through the record's parent; the frames it was made in are then
+// free to go. That is only valid when every free variable is defined by
+// the time the closure is made: a parameter, a define of an earlier
+// statement of the body, a capture of a converted enclosing function, or
+// the define the FunNode is the value of, which is the closure itself.
+// Anything else, a forward reference between inner defines, makes the
+// closure keep the frame it is made in as before (FunNode::capturesFrame),
+// and only that marks a frame as escaping.
+class Resolver {
+public:
+    Resolver();
+
+    // Resolve one top-level statement; may be called repeatedly
+    void resolve(Node* stmt);
+
+    // Number of slots the global frame needs for everything resolved so far
+    int globalCount() const { return globals.size; }
+
+    // Number of FunNodes resolved so far
+    int functionCount() const { return funsSeen; }
+
+    // Number of call sites handed out so far
+    int callSiteCount() const { return callSites; }
+
+    // Hand out the numbers from `count` on again, once the statements that
+    // had them are gone
+    void releaseCallSites(int count) { callSites = count; }
+
+private:
+    struct Scope {
+        Scope* parent;
+        std::unordered_map<Symbol, int> slots;
+        int size = 0;
+        FunNode* fun = nullptr; // Null for the global scope
+        int level = 0;          // Functions around it, itself included
+
+        explicit Scope(Scope* p) : parent(p) {}
+        int declare(Symbol name);
+    };
+
+    // A variable of an enclosing function, by the level of its scope
+    struct Capture {
+        int level;
+        int slot;
+        Symbol name;
+    };
+
+    // A function being converted
+    struct Closure {
+        FunNode* fun;
+        Closure* parent;
+        int level;
+        std::vector<Capture> free;  // Its free variables, in record order
+        std::vector<int> definedAt; // Statement of the body defining each slot
+        int stmt;                   // Statement of the body being converted
+    };
+
+    Scope globals;
+    std::unordered_map<FunNode*, std::vector<Capture>> freeVars; // Of the statement being resolved
+    int funsSeen = 0; // FunNodes resolved so far, for escape analysis
+    int callSites = 0;
+    std::string enclosing; // Name of the function being resolved, for naming lambdas
+
+    void resolveNode(Node* node, Scope* scope);
+    // Returns whether the variable is a global
+    bool lookup(VariableNode* var, Scope* scope);
+
+    void convert(Node* node, Closure* closure);
+    void convertFun(FunNode* fun, Closure* parent, int selfSlot);
+    // Point `var` at the variable (level, slot) as seen from `closure`
+    void address(Closure* closure, int level, int slot, VariableNode* var);
+};
+
+#endif
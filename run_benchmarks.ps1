@@ -0,0 +1,58 @@
+param(
+    # 產生的大型程式有幾組 define，用來量測 parser 的吞吐量
+    [int]$GeneratedSize = 20000
+)
+
+Write-Host "Starting Mini-LISP Benchmarks..." -ForegroundColor Cyan
+Write-Host "================================"
+
+# 產生大型程式: 每組包含一個常數、一個函式與一次呼叫
+$generated = Join-Path $env:TEMP "bench_generated.lsp"
+$sb = New-Object System.Text.StringBuilder
+for ($i = 0; $i -lt $GeneratedSize; $i++) {
+    [void]$sb.AppendLine("(define v$i (+ $i (* 2 $i) (mod $i 7)))")
+    [void]$sb.AppendLine("(define f$i (fun (x y) (if (< x y) (+ x v$i) (- y 1))))")
+    if ($i % 100 -eq 0) {
+        [void]$sb.AppendLine("(print-num (f$i $i (+ $i 1)))")
+    } else {
+        [void]$sb.AppendLine("(f$i $i (+ $i 1))")
+    }
+}
+[System.IO.File]::WriteAllText($generated, $sb.ToString())
+
+$files = @(Get-ChildItem "bench_data\*.lsp" | Sort-Object Name) + @(Get-Item $generated)
+# 每個 workload 分別用 AST 直譯、bytecode VM 與 --jit (熱函式編成機器碼) 執行
+$modes = @("", "--vm", "--jit")
+$results = @()
+
+foreach ($file in $files) {
+    # 寬的 variadic 運算在 --strict 下整串運算元一次檢查，也量測這個模式
+    $fileModes = $modes
+    if ($file.BaseName -eq "wide") { $fileModes += "--vm --strict" }
+    foreach ($mode in $fileModes) {
+        $label = if ($mode) { $mode } else { "--ast" }
+        Write-Host "Running $($file.Name) $label..." -ForegroundColor Yellow
+
+        # 量測整支程式 (parse + eval) 的執行時間; --bench 把各階段的
+        # 時間、配置次數與 peak RSS 印到 stderr
+        $cmdArgs = @("--bench")
+        if ($mode) { $cmdArgs += $mode.Split(" ") }
+        $cmdArgs += $file.FullName
+        $time = Measure-Command { $all = & .\minilisp.exe @cmdArgs 2>&1 }
+
+        $output = $all | Where-Object { $_ -isnot [System.Management.Automation.ErrorRecord] }
+        $phases = $all | Where-Object { $_ -is [System.Management.Automation.ErrorRecord] } | ForEach-Object { $_.ToString() }
+
+        $output | Select-Object -First 20
+        $phases
+        Write-Host ("Time: {0:N1} ms" -f $time.TotalMilliseconds)
+        $results += "{0}`t{1}`t{2:N1} ms" -f $file.Name, $label, $time.TotalMilliseconds
+        $results += $phases | ForEach-Object { "    $_" }
+
+        Write-Host "--------------------------------"
+    }
+}
+
+Remove-Item $generated
+$results | Out-File "bench_output.txt"
+Write-Host "Results written to bench_output.txt" -ForegroundColor Cyan
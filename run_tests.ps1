@@ -1,18 +1,83 @@
+param(
+    # 傳給直譯器的選項，例如 --parallel=4 或 --vm
+    [string[]]$Flags = @()
+)
+
 Write-Host "Starting Mini-LISP Test Suite..." -ForegroundColor Cyan
 Write-Host "================================"
 
 $files = Get-ChildItem "public_test_data\*.lsp" | Sort-Object Name
+$failed = 0
+
+# 回歸測試 (有 .ans 檔者) 在每個執行引擎下都比對：.ans 為預期的 stdout，
+# .err 為預期的 stderr (沒有則應為空)。有給 -Flags 時只用那組選項。
+$engines = @("", "--vm", "--jit", "--parallel=4", "--emit-cpp")
+if ($Flags.Count -gt 0) { $engines = @($Flags -join " ") }
+
+$stdoutFile = Join-Path $env:TEMP "minilisp_test.out"
+$stderrFile = Join-Path $env:TEMP "minilisp_test.err"
+$emitFile = Join-Path $env:TEMP "minilisp_test.cpp"
+$emitExe = Join-Path $env:TEMP "minilisp_test.exe"
+
+# 執行程式，stdout 與 stderr 分別寫入檔案 (保持原始位元組)，回傳結束碼
+function Invoke-Program([string]$program, [string]$arguments) {
+    $options = @{ FilePath = $program; NoNewWindow = $true; Wait = $true; PassThru = $true
+                  RedirectStandardOutput = $stdoutFile; RedirectStandardError = $stderrFile }
+    if ($arguments) { $options.ArgumentList = $arguments }
+    return (Start-Process @options).ExitCode
+}
+
+function Read-Text([string]$path) {
+    if (-not (Test-Path $path)) { return "" }
+    return (@(Get-Content $path) -join "`n")
+}
+
+# 以某個引擎執行一個檔案；--emit-cpp 先產生 C++，再對 libsmli 編譯後執行
+function Invoke-Engine([string]$engine, [string]$path) {
+    if ($engine -eq "--emit-cpp") {
+        if ((Invoke-Program ".\minilisp.exe" "--emit-cpp `"$path`"") -ne 0) { return $false }
+        Copy-Item $stdoutFile $emitFile -Force
+        g++ -std=c++11 -I. $emitFile libsmli.a -pthread -lpsapi -o $emitExe
+        if (-not $?) { return $false }
+        [void](Invoke-Program $emitExe "")
+    } else {
+        [void](Invoke-Program ".\minilisp.exe" "$engine `"$path`"")
+    }
+    return $true
+}
 
 foreach ($file in $files) {
     Write-Host "Running $($file.Name)..." -ForegroundColor Yellow
-    
+
     # 執行直譯器並傳入檔案路徑
-    $output = & .\minilisp.exe $file.FullName
-    
+    $output = & .\minilisp.exe @Flags $file.FullName
+
     # 顯示輸出結果
     $output
-    
+
+    $answer = [System.IO.Path]::ChangeExtension($file.FullName, ".ans")
+    if (Test-Path $answer) {
+        $expected = Read-Text $answer
+        $expectedErrors = Read-Text ([System.IO.Path]::ChangeExtension($file.FullName, ".err"))
+        foreach ($engine in $engines) {
+            $name = if ($engine) { $engine } else { "default" }
+            if (-not (Invoke-Engine $engine $file.FullName)) {
+                Write-Host "FAIL [$name]: could not build the emitted C++" -ForegroundColor Red
+                $failed++
+            } elseif ((Read-Text $stdoutFile) -ne $expected -or (Read-Text $stderrFile) -ne $expectedErrors) {
+                Write-Host "FAIL [$name]: output differs from $([System.IO.Path]::GetFileName($answer))" -ForegroundColor Red
+                $failed++
+            } else {
+                Write-Host "PASS [$name]" -ForegroundColor Green
+            }
+        }
+    }
+
     Write-Host "--------------------------------"
 }
 
+if ($failed -gt 0) {
+    Write-Host "$failed regression test(s) failed." -ForegroundColor Red
+    exit 1
+}
 Write-Host "All tests completed." -ForegroundColor Cyan
@@ -0,0 +1,72 @@
+#include "runtime.h"
+
+#include "stats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+thread_local Runtime* runtime = nullptr;
+thread_local uintptr_t stackLimit = 0;
+static thread_local size_t depthLimit = 0;
+
+// Stack of the leanest non-tail call of the tree walker, measured with
+// (fun (n) (if (= n 0) 0 (+ 1 (f (- n 1))))) on x86-64: CallNode::eval,
+// CallNode::run and the typed operator it is an operand of
+#ifdef __OPTIMIZE__
+static const size_t WALKER_CALL_BYTES = 144;
+#else
+static const size_t WALKER_CALL_BYTES = 352;
+#endif
+
+void limitStack(size_t bytes) {
+    char here;
+    uintptr_t top = reinterpret_cast<uintptr_t>(&here);
+    size_t usable = bytes - bytes / 8;
+    stackLimit = usable < top ? top - usable : 0;
+    depthLimit = usable / WALKER_CALL_BYTES;
+}
+
+size_t callDepthLimit() {
+    return depthLimit;
+}
+
+size_t mainStackSize() {
+#ifdef _WIN32
+    // The reserve in the header of the executable
+    const char* image = reinterpret_cast<const char*>(GetModuleHandle(nullptr));
+    const IMAGE_NT_HEADERS* headers =
+        reinterpret_cast<const IMAGE_NT_HEADERS*>(image + reinterpret_cast<const IMAGE_DOS_HEADER*>(image)->e_lfanew);
+    return size_t(headers->OptionalHeader.SizeOfStackReserve);
+#else
+    rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) return size_t(limit.rlim_cur);
+    return 0;
+#endif
+}
+
+size_t threadStackSize() {
+    size_t size = mainStackSize();
+    return size ? size : size_t(8) << 20;
+}
+
+Runtime::Runtime(std::ostream& o, std::ostream& e) : memo(heap), out(o), err(&e) {
+    heap.attachCache(&memo);
+    if (stats.enabled()) stats.attach(this);
+}
+
+Runtime::~Runtime() {
+    if (stats.enabled()) stats.detach(this);
+}
+
+void Runtime::report(const ProgramError& error) {
+    if (error.toStderr) {
+        out.flush();
+        *err << error.message << std::endl;
+    } else {
+        out.printLine(error.message.data(), error.message.size());
+        out.flush();
+    }
+}
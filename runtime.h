@@ -0,0 +1,106 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "heap.h"
+#include "memo.h"
+#include "output.h"
+
+// An error that ends the program: a type, name, arity, division or syntax
+// error. The error helpers throw it instead of exiting, and whoever runs
+// the program reports it the way the interpreter always has: the message
+// goes to stdout for type and syntax errors and to stderr for the rest,
+// and `status` is the exit code.
+struct ProgramError {
+    std::string message;
+    bool toStderr;
+    int status;
+};
+
+// The mutable state of one program run: the collector, the frame arena,
+// the --memoize cache, the call site caches, the buffered program output
+// and the error stream. The interpreter reaches it
+// through `runtime`, which is per thread, so every thread can run a
+// program of its own.
+class Runtime {
+public:
+    Heap heap;
+    FrameArena frames;
+    Memo memo;
+    std::vector<CallSite> callSites; // Indexed by CallNode::site
+    OutputBuffer out;
+    std::ostream* err;
+
+    Runtime(std::ostream& out, std::ostream& err);
+    ~Runtime();
+    Runtime(const Runtime&) = delete;
+    Runtime& operator=(const Runtime&) = delete;
+
+    // Print the message of `error` where the command line interpreter does,
+    // after everything the program printed before it
+    void report(const ProgramError& error);
+};
+
+// Runtime of the program running on this thread
+extern thread_local Runtime* runtime;
+
+// Lowest stack address a call on this thread may start at, 0 for no limit.
+// The tree walker recurses on the C++ stack, so a deep enough recursion in
+// the program would overflow it and take the process down; past the limit
+// a call fails with an error instead (recursionError).
+extern thread_local uintptr_t stackLimit;
+
+// Let calls on this thread use most of the `bytes` of stack below the
+// caller; the rest is left for what runs between two calls and for
+// reporting the error
+void limitStack(size_t bytes);
+
+// Calls the VM may nest on this thread, 0 for no limit. The VM keeps its
+// calls on the heap, but a recursion should fail at the same depth on
+// every engine, so this is how many of the tree walker's leanest calls fit
+// in the stack limit. A recursion that fails on the VM therefore fails in
+// the tree walker too; one whose calls sit deeper inside expressions takes
+// more stack per call there and may fail in the tree walker a little
+// earlier.
+size_t callDepthLimit();
+
+// Stack size of the main thread, 0 when unknown or unlimited
+size_t mainStackSize();
+
+// Stack size of the interpreter's threads, the main one and those it
+// starts (pool and server workers): the main thread's, so a program
+// recurses as deep on any of them, or 8 MB when that is not known
+size_t threadStackSize();
+
+inline bool stackExhausted() {
+    char here;
+    return reinterpret_cast<uintptr_t>(&here) < stackLimit;
+}
+
+// Keeps the bignums an evaluator holds in locals alive while it evaluates
+// further operands, any of which may reach a safe point. Fixnums are not
+// pushed, so the common case costs a tag test.
+class TempRoots {
+public:
+    TempRoots() = default;
+    ~TempRoots() {
+        if (base != NONE) runtime->heap.popTemps(base);
+    }
+    TempRoots(const TempRoots&) = delete;
+    TempRoots& operator=(const TempRoots&) = delete;
+
+    void keep(Value v) {
+        if (!v.isBignum()) return;
+        if (base == NONE) base = runtime->heap.tempCount();
+        runtime->heap.pushTemp(v);
+    }
+
+private:
+    static const size_t NONE = ~size_t(0);
+    size_t base = NONE;
+};
+
+#endif
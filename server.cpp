@@ -0,0 +1,178 @@
+#include "server.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "minilisp.h"
+#include "runtime.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+namespace {
+
+bool readAll(int fd, std::string& data) {
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, buffer, sizeof buffer);
+        if (n == 0) return true;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data.append(buffer, size_t(n));
+    }
+}
+
+bool writeAll(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += size_t(n);
+    }
+    return true;
+}
+
+bool socketAddress(const char* path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof addr.sun_path) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strcpy(addr.sun_path, path);
+    return true;
+}
+
+void answer(const Prelude& prelude, int client) {
+    std::string source;
+    if (readAll(client, source)) {
+        EvalResult result = prelude.run(source);
+        std::string reply = std::to_string(result.status) + " " + std::to_string(result.output.size()) + " " +
+                            std::to_string(result.errors.size()) + "\n";
+        // A client that went away only loses its answer
+        writeAll(client, reply + result.output + result.errors);
+    }
+    ::close(client);
+}
+
+struct Worker {
+    const Prelude* prelude;
+    int listener;
+};
+
+// Answer the connections a worker accepts, one at a time, until the
+// socket fails
+void* work(void* arg) {
+    const Worker& worker = *static_cast<const Worker*>(arg);
+    // Snippets recurse on this stack; past most of it a call fails with an
+    // error rather than crash the server
+    limitStack(threadStackSize());
+    for (;;) {
+        int client = ::accept(worker.listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            std::perror("accept");
+            break;
+        }
+        answer(*worker.prelude, client);
+    }
+    return nullptr;
+}
+
+} // namespace
+
+int serve(const char* path, const Prelude& prelude, unsigned jobs) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return 1;
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::perror("socket");
+        return 1;
+    }
+    // A socket file left by an earlier server
+    ::unlink(path);
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0 || ::listen(listener, 64) < 0) {
+        std::perror(path);
+        ::close(listener);
+        return 1;
+    }
+    // Writing to a client that closed must not end the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Every worker waits in accept() on the socket; std::thread cannot be
+    // given a stack size
+    Worker worker = {&prelude, listener};
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, threadStackSize());
+    std::vector<pthread_t> workers;
+    for (unsigned i = 0; i < (jobs ? jobs : 1); ++i) {
+        pthread_t thread;
+        int failed = pthread_create(&thread, &attr, work, &worker);
+        if (failed) {
+            std::cerr << "Cannot start a worker: " << std::strerror(failed) << std::endl;
+            break;
+        }
+        workers.push_back(thread);
+    }
+    pthread_attr_destroy(&attr);
+    for (pthread_t thread : workers) pthread_join(thread, nullptr);
+    ::close(listener);
+    return 1;
+}
+
+int request(const char* path, const std::string& source) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return 1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) {
+        std::perror(path);
+        if (fd >= 0) ::close(fd);
+        return 1;
+    }
+    std::string reply;
+    bool ok = writeAll(fd, source) && ::shutdown(fd, SHUT_WR) == 0 && readAll(fd, reply);
+    ::close(fd);
+
+    int status;
+    size_t outputBytes, errorBytes;
+    size_t header = reply.find('\n');
+    if (!ok || header == std::string::npos ||
+        std::sscanf(reply.c_str(), "%d %zu %zu", &status, &outputBytes, &errorBytes) != 3 ||
+        reply.size() - header - 1 != outputBytes + errorBytes) {
+        std::cerr << "Bad reply from " << path << std::endl;
+        return 1;
+    }
+    std::cout.write(reply.data() + header + 1, outputBytes);
+    std::cout.flush();
+    std::cerr.write(reply.data() + header + 1 + outputBytes, errorBytes);
+    return status;
+}
+
+#else
+
+int serve(const char* path, const Prelude& prelude, unsigned jobs) {
+    std::cerr << "--serve needs Unix domain sockets" << std::endl;
+    return 1;
+}
+
+int request(const char* path, const std::string& source) {
+    std::cerr << "--connect needs Unix domain sockets" << std::endl;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+
+class Prelude;
+
+// --serve: a long-running interpreter on a Unix domain socket, so that
+// scripts sharing a prelude do not pay for loading it every time (see
+// Prelude in minilisp.h). A client connects, sends a snippet and shuts down
+// its side for writing; the server runs the snippet after the prelude and
+// answers with one header line
+//
+//   STATUS OUTPUT-BYTES ERROR-BYTES
+//
+// followed by what the snippet printed and then its error messages, the
+// stdout and stderr of running it as a file, and closes the connection.
+// Connections are served by `jobs` threads at once, each with a stack as
+// large as the main thread's; a snippet recursing deeper than a file run
+// could gets the error reply of a failed run. --connect is the client:
+// a drop-in for running a file, with the server's output and exit status.
+//
+// Unix only; elsewhere both report that and fail.
+
+// Serve snippets on `path` until the process is killed; returns the exit
+// status when the socket cannot be set up
+int serve(const char* path, const Prelude& prelude, unsigned jobs);
+
+// Have the server on `path` run `source`, print its output and errors to
+// stdout and stderr, and return its exit status
+int request(const char* path, const std::string& source);
+
+#endif
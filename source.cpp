@@ -0,0 +1,84 @@
+#include "source.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SourceBuffer::~SourceBuffer() {
+    release();
+}
+
+void SourceBuffer::release() {
+#ifndef _WIN32
+    if (mapped) {
+        munmap(text, mapped);
+        text = nullptr;
+    }
+#endif
+    std::free(text);
+    text = nullptr;
+    length = mapped = 0;
+}
+
+bool SourceBuffer::open(const char* path) {
+    release();
+#ifndef _WIN32
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t n = size_t(st.st_size);
+        void* region = mmap(nullptr, n + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region != MAP_FAILED &&
+            (n == 0 || mmap(region, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED)) {
+            close(fd);
+            text = static_cast<char*>(region);
+            length = n;
+            mapped = n + 2;
+            return true;
+        }
+        if (region != MAP_FAILED) munmap(region, n + 2);
+    }
+    close(fd);
+#endif
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    bool ok = read(file);
+    fclose(file);
+    return ok;
+}
+
+bool SourceBuffer::read(FILE* file) {
+    release();
+    size_t capacity = 64 * 1024;
+    text = static_cast<char*>(std::malloc(capacity));
+    if (!text) return false;
+    size_t n;
+    while ((n = fread(text + length, 1, capacity - 2 - length, file)) > 0) {
+        length += n;
+        if (capacity - 2 - length == 0) {
+            capacity *= 2;
+            char* grown = static_cast<char*>(std::realloc(text, capacity));
+            if (!grown) return false;
+            text = grown;
+        }
+    }
+    text[length] = text[length + 1] = '\0';
+    return !ferror(file);
+}
+
+bool SourceBuffer::assign(const char* source, size_t n) {
+    release();
+    text = static_cast<char*>(std::malloc(n + 2));
+    if (!text) return false;
+    std::memcpy(text, source, n);
+    length = n;
+    text[length] = text[length + 1] = '\0';
+    return true;
+}
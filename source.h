@@ -0,0 +1,40 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <cstdio>
+
+// The text of a source file followed by the two NUL bytes flex's
+// yy_scan_buffer needs. A regular file is memory-mapped where the platform
+// allows it: the file is mapped over the start of a zeroed anonymous
+// region two bytes longer than the file. Other inputs (stdin, pipes) are
+// read into memory. Flex writes into the buffer while scanning, so the
+// mapping is private to the process.
+class SourceBuffer {
+public:
+    SourceBuffer() = default;
+    ~SourceBuffer();
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    // Map or read the file at `path`; false if it cannot be opened
+    bool open(const char* path);
+
+    // Read all of `file`
+    bool read(FILE* file);
+
+    // Copy `length` bytes of `source`
+    bool assign(const char* source, size_t length);
+
+    char* data() { return text; }
+    size_t size() const { return length; } // Without the trailing NULs
+
+private:
+    char* text = nullptr;
+    size_t length = 0;
+    size_t mapped = 0; // Bytes mapped, or 0 when `text` was allocated
+
+    void release();
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <typeinfo>
+#include "bench.h"
+#include "runtime.h"
+
+Stats stats;
+
+namespace {
+
+const char* const KIND_NAMES[Stats::KINDS] = {
+    "number", "boolean", "variable", "operator", "typed_operator", "if",
+    "print", "define", "block", "lambda", "call"
+};
+
+thread_local Stats::Counters* mine = nullptr;
+
+// One more evaluation live on this thread while it exists
+struct Nesting {
+    Stats::Counters& c;
+    explicit Nesting(Stats::Counters& counters) : c(counters) {
+        if (++c.depth > c.peakDepth) c.peakDepth = c.depth;
+    }
+    ~Nesting() { --c.depth; }
+};
+
+void countLookup(Stats::Counters& c, int walk) {
+    c.lookups++;
+    c.framesWalked += walk;
+    if (walk > c.maxWalk) c.maxWalk = walk;
+}
+
+Stats::Counters& count(const CountedNode& node) {
+    Stats::Counters& c = Stats::local();
+    c.nodes[node.kind]++;
+    if (node.kind == Stats::VARIABLE) {
+        countLookup(c, node.walk);
+    } else if (node.kind == Stats::LAMBDA) {
+        // Making the closure reads its captures
+        FunNode* fun = static_cast<FunNode*>(node.inner);
+        for (size_t i = 0; i < fun->captures.size(); ++i) {
+            if (int(i) != fun->selfCapture) countLookup(c, fun->captures[i]->depth);
+        }
+    } else if (node.kind == Stats::CALL) {
+        c.calls++;
+    }
+    return c;
+}
+
+Node* wrap(Node* node) {
+    Stats::Kind kind;
+    int walk = 0;
+    if (dynamic_cast<NumberNode*>(node)) {
+        kind = Stats::NUMBER;
+    } else if (dynamic_cast<BoolNode*>(node)) {
+        kind = Stats::BOOLEAN;
+    } else if (auto var = dynamic_cast<VariableNode*>(node)) {
+        kind = Stats::VARIABLE;
+        walk = var->depth;
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        for (Node*& arg : op->args) arg = wrap(arg);
+        kind = typeid(*op) == typeid(BinaryOpNode) ? Stats::OPERATOR : Stats::TYPED_OPERATOR;
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        ifn->testExp = wrap(ifn->testExp);
+        ifn->thenExp = wrap(ifn->thenExp);
+        ifn->elseExp = wrap(ifn->elseExp);
+        kind = Stats::IF;
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        print->exp = wrap(print->exp);
+        kind = Stats::PRINT;
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        def->exp = wrap(def->exp);
+        kind = Stats::DEFINE;
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (Node*& stmt : block->stmts) stmt = wrap(stmt);
+        kind = Stats::BLOCK;
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        fun->body = wrap(fun->body);
+        kind = Stats::LAMBDA;
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        call->funcExp = wrap(call->funcExp);
+        for (Node*& arg : call->args) arg = wrap(arg);
+        kind = Stats::CALL;
+    } else {
+        return node;
+    }
+    CountedNode* counted = new CountedNode(node, kind);
+    counted->walk = walk;
+    return counted;
+}
+
+void addHeap(Stats::HeapCounters& total, Runtime* rt) {
+    const Heap::Stats& heap = rt->heap.stats();
+    total.closures += heap.closuresAllocated;
+    total.heapFrames += heap.framesAllocated;
+    total.arenaFrames += rt->frames.pushes();
+    total.bignums += heap.bignumsAllocated;
+    total.bytes += heap.bytesAllocated;
+    total.collections += heap.collections;
+}
+
+} // namespace
+
+Value CountedNode::eval(Environment* env) {
+    Nesting live(count(*this));
+    return inner->eval(env);
+}
+
+Value CountedNode::evalTail(Environment* env, TailCall& tail) {
+    Stats::Counters& c = count(*this);
+    if (kind == Stats::CALL) c.tailCalls++;
+    Nesting live(c);
+    return inner->evalTail(env, tail);
+}
+
+Node* Stats::instrument(Node* stmt) {
+    return wrap(stmt);
+}
+
+Stats::Counters& Stats::local() {
+    if (!mine) mine = stats.join();
+    return *mine;
+}
+
+Stats::Counters* Stats::join() {
+    std::lock_guard<std::mutex> guard(lock);
+    threads.emplace_back(new Counters);
+    return threads.back().get();
+}
+
+void Stats::attach(Runtime* rt) {
+    std::lock_guard<std::mutex> guard(lock);
+    runtimes.push_back(rt);
+}
+
+void Stats::detach(Runtime* rt) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = std::find(runtimes.begin(), runtimes.end(), rt);
+    if (it == runtimes.end()) return;
+    addHeap(finished, rt);
+    runtimes.erase(it);
+}
+
+void Stats::print(std::ostream& os) {
+    bench.stop();
+    std::lock_guard<std::mutex> guard(lock);
+    Counters total;
+    for (const std::unique_ptr<Counters>& c : threads) {
+        for (int k = 0; k < KINDS; ++k) total.nodes[k] += c->nodes[k];
+        total.lookups += c->lookups;
+        total.framesWalked += c->framesWalked;
+        total.maxWalk = std::max(total.maxWalk, c->maxWalk);
+        total.calls += c->calls;
+        total.tailCalls += c->tailCalls;
+        total.peakDepth = std::max(total.peakDepth, c->peakDepth);
+    }
+    HeapCounters heap = finished;
+    for (Runtime* rt : runtimes) addHeap(heap, rt);
+
+    size_t evaluations = 0;
+    os << "{\n  \"threads\": " << threads.size() << ",\n  \"nodes\": {";
+    for (int k = 0; k < KINDS; ++k) {
+        os << (k ? ", " : "") << "\"" << KIND_NAMES[k] << "\": " << total.nodes[k];
+        evaluations += total.nodes[k];
+    }
+    os << "},\n"
+       << "  \"evaluations\": " << evaluations << ",\n"
+       << "  \"peak_eval_depth\": " << total.peakDepth << ",\n"
+       << "  \"lookups\": {\"count\": " << total.lookups << ", \"frames_walked\": " << total.framesWalked
+       << ", \"max_walk\": " << total.maxWalk << "},\n"
+       << "  \"calls\": {\"count\": " << total.calls << ", \"tail\": " << total.tailCalls << "},\n"
+       << "  \"heap\": {\"closures\": " << heap.closures << ", \"heap_frames\": " << heap.heapFrames
+       << ", \"arena_frames\": " << heap.arenaFrames << ", \"bignums\": " << heap.bignums
+       << ", \"bytes\": " << heap.bytes << ", \"collections\": " << heap.collections << "},\n"
+       << "  \"phases_ms\": {";
+    // A phase that ran more than once is summed
+    std::vector<std::pair<std::string, double>> phases;
+    for (const Bench::Phase& p : bench.recorded()) {
+        auto same = std::find_if(phases.begin(), phases.end(),
+                                 [&p](const std::pair<std::string, double>& q) { return q.first == p.name; });
+        if (same != phases.end()) {
+            same->second += p.ms;
+        } else {
+            phases.push_back(std::make_pair(std::string(p.name), p.ms));
+        }
+    }
+    os << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < phases.size(); ++i) {
+        os << (i ? ", " : "") << "\"" << phases[i].first << "\": " << phases[i].second;
+    }
+    os << "}\n}" << std::endl;
+
+    // Runtimes destroyed from here on, at exit, have nothing to add
+    on = false;
+}
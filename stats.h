@@ -0,0 +1,102 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ast.h"
+
+class Runtime;
+
+// Interpreter counters for --stats, printed as JSON on exit. Compiled in
+// always and free while off: a Program started with stats on gets every
+// node of its AST wrapped in a CountedNode after the other passes, which
+// counts and forwards the evaluation, so the evaluator itself has no
+// checks. Counted for the tree walker:
+//   - evaluations per node kind, and the deepest nesting of evaluations
+//     live at once (the C++ recursion; tail calls do not nest),
+//   - variable lookups and how many frames up the static chain they
+//     walk (Environment::ancestor),
+//   - calls, and how many of them were tail calls.
+// Every runtime, on either engine, adds its heap's closures, frames,
+// bignums and collections, and the arena's frames.
+//
+// The counters are per thread: a thread registers its own block the first
+// time it counts, so --batch and --parallel workers never share a cache
+// line, and print() merges the blocks and the runtimes still alive with
+// what finished runtimes handed over. The phase times are those of --bench
+// (bench.h), for a single program; parsing includes the scanner.
+//
+// Not for the JIT (native code is not counted), --emit-cpp, whose passes
+// do not know CountedNode, or --serve, which never exits.
+class Stats {
+public:
+    enum Kind { NUMBER, BOOLEAN, VARIABLE, OPERATOR, TYPED_OPERATOR, IF, PRINT, DEFINE, BLOCK, LAMBDA, CALL, KINDS };
+
+    struct Counters {
+        size_t nodes[KINDS] = {};
+        size_t lookups = 0;
+        size_t framesWalked = 0;  // Over all lookups
+        int maxWalk = 0;
+        size_t calls = 0;         // Tail calls included
+        size_t tailCalls = 0;
+        int depth = 0;            // Evaluations live now
+        int peakDepth = 0;
+    };
+
+    struct HeapCounters {
+        size_t closures = 0;
+        size_t heapFrames = 0;
+        size_t arenaFrames = 0;
+        size_t bignums = 0;
+        size_t bytes = 0;
+        size_t collections = 0;
+    };
+
+    void start() { on = true; }
+    bool enabled() const { return on; }
+
+    // Wrap `stmt` and every node in it; returns the replacement
+    Node* instrument(Node* stmt);
+
+    // The counters of this thread
+    static Counters& local();
+
+    // Runtimes made after start() attach themselves; one made before has
+    // to be attached by hand
+    void attach(Runtime* rt);
+    // Hand over the heap counters of a runtime about to be destroyed
+    void detach(Runtime* rt);
+
+    // Merge everything counted so far and print it as JSON. Meant for the
+    // end of the process: counting stops, so the runtimes destroyed at exit
+    // do not need the Stats any more.
+    void print(std::ostream& os);
+
+private:
+    bool on = false;
+    std::mutex lock; // Guards the members below
+    std::vector<std::unique_ptr<Counters>> threads;
+    std::vector<Runtime*> runtimes;
+    HeapCounters finished;
+
+    Counters* join();
+};
+
+extern Stats stats;
+
+// A node of an instrumented AST: counts, then evaluates `inner`
+struct CountedNode : Node {
+    Node* inner;
+    Stats::Kind kind;
+    int walk = 0; // Frames a variable lookup goes up
+
+    CountedNode(Node* n, Stats::Kind k) : inner(n), kind(k) {}
+    ~CountedNode() { delete inner; }
+    Value eval(Environment* env) override;
+    Value evalTail(Environment* env, TailCall& tail) override;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "symbols.h"
+
+#include <cstring>
+
+SymbolTable symbols;
+
+bool SymbolTable::Key::operator==(const Key& other) const {
+    return length == other.length && std::memcmp(text, other.text, length) == 0;
+}
+
+size_t SymbolTable::KeyHash::operator()(const Key& key) const {
+    // FNV-1a
+    size_t h = 2166136261u;
+    for (size_t i = 0; i < key.length; ++i) {
+        h = (h ^ (unsigned char)key.text[i]) * 16777619u;
+    }
+    return h;
+}
+
+Symbol SymbolTable::intern(const char* text, size_t length) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = ids.find(Key{text, length});
+    if (it != ids.end()) return it->second;
+    names.push_back(std::string(text, length));
+    const std::string& stored = names.back();
+    Symbol id = Symbol(names.size() - 1);
+    ids[Key{stored.data(), stored.size()}] = id;
+    return id;
+}
+
+const std::string& SymbolTable::name(Symbol id) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return names[id];
+}
+
+size_t SymbolTable::size() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return names.size();
+}
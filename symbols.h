@@ -0,0 +1,45 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Dense id of an interned identifier
+typedef int Symbol;
+
+// Every distinct identifier gets an id the first time the scanner sees it.
+// The AST, the resolver and the VM carry only ids and compare integers;
+// the text is needed only for error messages and reports. The table is
+// shared by every parse, so it takes a lock, and a name keeps its address
+// once interned.
+class SymbolTable {
+public:
+    Symbol intern(const char* text, size_t length);
+    Symbol intern(const std::string& text) { return intern(text.data(), text.size()); }
+
+    const std::string& name(Symbol id) const;
+
+    size_t size() const;
+
+private:
+    // Text of a name without copying it, for lookups straight from the source
+    struct Key {
+        const char* text;
+        size_t length;
+        bool operator==(const Key& other) const;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    mutable std::mutex lock;
+    std::deque<std::string> names; // Keys point into these
+    std::unordered_map<Key, Symbol, KeyHash> ids;
+};
+
+extern SymbolTable symbols;
+
+#endif
@@ -0,0 +1,200 @@
+#include "typer.h"
+
+void Typer::run(std::vector<Node*>& program, int globalCount) {
+    globals.types.assign(globalCount, NONE);
+    globals.defines.assign(globalCount, 0);
+    globals.escapes.assign(globalCount, false);
+    globals.functions.assign(globalCount, nullptr);
+    for (Node* stmt : program) scan(stmt, false);
+
+    // A function whose name only ever appears as a callee is reached by the
+    // calls scanned here and nothing else
+    auto markKnown = [this](Frame& frame) {
+        for (size_t slot = 0; slot < frame.types.size(); ++slot) {
+            if (frame.functions[slot] && frame.defines[slot] == 1 && !frame.escapes[slot]) {
+                frames[frame.functions[slot]].callsKnown = true;
+            }
+        }
+    };
+    markKnown(globals);
+    for (auto& entry : frames) markKnown(entry.second);
+    for (auto& entry : frames) {
+        Frame& frame = entry.second;
+        if (!frame.callsKnown) {
+            for (int i = 0; i < frame.params; ++i) frame.types[i] = ANY;
+        }
+    }
+
+    do {
+        changed = false;
+        for (Node*& stmt : program) infer(stmt, false);
+    } while (changed);
+    for (Node*& stmt : program) infer(stmt, true);
+}
+
+Typer::Frame& Typer::frameOf(VariableNode* var, int& slot) {
+    slot = var->slot;
+    int depth = var->depth;
+    for (size_t i = enclosing.size(); i > 0; --i) {
+        FunNode* fun = enclosing[i - 1];
+        if (depth == 0) return frames[fun];
+        if (fun->capturesFrame) {
+            --depth;
+        } else if (depth == 1 && !fun->captures.empty()) {
+            // A copy of a variable of the functions around it
+            VariableNode* captured = fun->captures[slot];
+            depth = captured->depth;
+            slot = captured->slot;
+        } else {
+            break;
+        }
+    }
+    return globals;
+}
+
+FunNode* Typer::callee(Node* funcExp) {
+    if (auto fun = dynamic_cast<FunNode*>(funcExp)) return fun;
+    if (auto var = dynamic_cast<VariableNode*>(funcExp)) {
+        int slot;
+        Frame& frame = frameOf(var, slot);
+        if (frame.defines[slot] == 1) return frame.functions[slot];
+    }
+    return nullptr;
+}
+
+void Typer::assign(Frame& frame, int slot, Type type) {
+    Type joined = join(frame.types[slot], type);
+    if (joined != frame.types[slot]) {
+        frame.types[slot] = joined;
+        changed = true;
+    }
+}
+
+// Count the defines of every slot and find the names used as values
+void Typer::scan(Node* node, bool isCallee) {
+    if (auto var = dynamic_cast<VariableNode*>(node)) {
+        int slot;
+        Frame& frame = frameOf(var, slot);
+        if (!isCallee) frame.escapes[slot] = true;
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        for (Node* arg : op->args) scan(arg, false);
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        scan(ifn->testExp, false);
+        scan(ifn->thenExp, false);
+        scan(ifn->elseExp, false);
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        scan(print->exp, false);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        Frame& frame = ownFrame();
+        frame.functions[def->slot] = dynamic_cast<FunNode*>(def->exp);
+        frame.defines[def->slot]++;
+        scan(def->exp, false);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (Node* stmt : block->stmts) scan(stmt, false);
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        Frame& frame = frames[fun];
+        frame.types.assign(fun->frameSize, NONE);
+        frame.defines.assign(fun->frameSize, 0);
+        frame.escapes.assign(fun->frameSize, false);
+        frame.functions.assign(fun->frameSize, nullptr);
+        frame.params = int(fun->params.size());
+        enclosing.push_back(fun);
+        scan(fun->body, false);
+        enclosing.pop_back();
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        scan(call->funcExp, true);
+        for (Node* arg : call->args) scan(arg, false);
+        if (auto fun = dynamic_cast<FunNode*>(call->funcExp)) frames[fun].callsKnown = true;
+    }
+}
+
+namespace {
+
+// The unchecked form of an operator whose operands are all proven
+BinaryOpNode* specialize(BinaryOpNode* op) {
+    switch (op->op) {
+    case OpCode::ADD:     return new AddIntNode(op->op, op->args);
+    case OpCode::SUB:     return new SubIntNode(op->op, op->args);
+    case OpCode::MUL:     return new MulIntNode(op->op, op->args);
+    case OpCode::DIV:     return new DivIntNode(op->op, op->args);
+    case OpCode::MOD:     return new ModIntNode(op->op, op->args);
+    case OpCode::GREATER: return new GreaterIntNode(op->op, op->args);
+    case OpCode::SMALLER: return new LessIntNode(op->op, op->args);
+    case OpCode::EQUAL:   return new EqualIntNode(op->op, op->args);
+    case OpCode::AND:     return new AndBoolNode(op->op, op->args);
+    case OpCode::OR:      return new OrBoolNode(op->op, op->args);
+    case OpCode::NOT:     return new NotBoolNode(op->op, op->args);
+    }
+    return op;
+}
+
+} // namespace
+
+// Type of the value of `node`. With `rewriting`, which is only set once
+// the types are final, proven nodes are replaced as well.
+Typer::Type Typer::infer(Node*& node, bool rewriting) {
+    if (dynamic_cast<NumberNode*>(node)) {
+        return NUMBER;
+    } else if (dynamic_cast<BoolNode*>(node)) {
+        return BOOLEAN;
+    } else if (auto var = dynamic_cast<VariableNode*>(node)) {
+        int slot;
+        Frame& frame = frameOf(var, slot);
+        return frame.types[slot];
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        bool logical = op->op == OpCode::AND || op->op == OpCode::OR || op->op == OpCode::NOT;
+        bool arithmetic = op->op == OpCode::ADD || op->op == OpCode::SUB || op->op == OpCode::MUL ||
+                          op->op == OpCode::DIV || op->op == OpCode::MOD;
+        bool proven = true;
+        for (Node*& arg : op->args) {
+            if (infer(arg, rewriting) != (logical ? BOOLEAN : NUMBER)) proven = false;
+        }
+        if (rewriting && proven) {
+            node = specialize(op);
+            op->args.clear(); // Now owned by the new node
+            delete op;
+        }
+        return arithmetic ? NUMBER : BOOLEAN;
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        bool proven = infer(ifn->testExp, rewriting) == BOOLEAN;
+        Type type = join(infer(ifn->thenExp, rewriting), infer(ifn->elseExp, rewriting));
+        if (rewriting && proven) {
+            node = new IfBoolNode(ifn->testExp, ifn->thenExp, ifn->elseExp);
+            ifn->testExp = ifn->thenExp = ifn->elseExp = nullptr;
+            delete ifn;
+        }
+        return type;
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        infer(print->exp, rewriting);
+    } else if (auto def = dynamic_cast<DefineNode*>(node)) {
+        Type type = infer(def->exp, rewriting);
+        assign(ownFrame(), def->slot, type);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        Type type = NONE;
+        for (Node*& stmt : block->stmts) type = infer(stmt, rewriting);
+        return type;
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        enclosing.push_back(fun);
+        Type type = infer(fun->body, rewriting);
+        enclosing.pop_back();
+        Frame& frame = frames[fun];
+        Type joined = join(frame.returns, type);
+        if (joined != frame.returns) {
+            frame.returns = joined;
+            changed = true;
+        }
+        return FUNCTION;
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        FunNode* fun = callee(call->funcExp);
+        infer(call->funcExp, rewriting);
+        Frame* frame = fun ? &frames[fun] : nullptr;
+        // A call with the wrong number of arguments fails before binding any
+        bool binds = frame && frame->callsKnown && call->args.size() == fun->params.size();
+        for (size_t i = 0; i < call->args.size(); ++i) {
+            Type type = infer(call->args[i], rewriting);
+            if (binds) assign(*frame, int(i), type);
+        }
+        return frame ? frame->returns : ANY;
+    }
+    return NONE;
+}
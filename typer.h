@@ -0,0 +1,62 @@
+#ifndef TYPER_H
+#define TYPER_H
+
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+// Type inference over the whole resolved (and folded) program, run before
+// evaluation. It proves which operands are always numbers or booleans and
+// rewrites the operators and ifs whose every operand is proven into the
+// unchecked nodes of ast.h (AddIntNode, LessIntNode, IfBoolNode, ...).
+// Where a type is not known the checked node stays, so type errors are
+// reported exactly as before.
+//
+// Every frame slot (a global, a parameter or an inner define) gets the
+// join of what may be stored in it: the values of its defines, and for a
+// parameter the arguments of every call that can reach it. The calls are
+// only all known for a function that is called directly or bound by a
+// single define whose name is never used other than as a callee; the
+// parameters of every other function are unknown. A call of a known
+// function has the type its body returns. Everything is iterated to a
+// fixed point, so recursive functions get the types their callers give
+// them (fib's n is a number because every call passes one).
+class Typer {
+public:
+    // Infer the types of `program`, whose global frame has `globalCount`
+    // slots, and rewrite it in place
+    void run(std::vector<Node*>& program, int globalCount);
+
+private:
+    //                  NONE: nothing seen yet
+    // NUMBER, BOOLEAN, FUNCTION: always that
+    //                   ANY: not known
+    enum Type { NONE, NUMBER, BOOLEAN, FUNCTION, ANY };
+
+    static Type join(Type a, Type b) { return a == NONE ? b : b == NONE || a == b ? a : ANY; }
+
+    struct Frame {
+        std::vector<Type> types;
+        std::vector<int> defines;        // DefineNodes of the slot
+        std::vector<bool> escapes;       // Read other than as a callee
+        std::vector<FunNode*> functions; // The FunNode of its only define
+        int params = 0;
+        bool callsKnown = false;         // Every call of the function is seen
+        Type returns = NONE;
+    };
+
+    Frame globals;
+    std::unordered_map<FunNode*, Frame> frames;
+    std::vector<FunNode*> enclosing; // Functions around the current node
+    bool changed = false;
+
+    Frame& frameOf(VariableNode* var, int& slot);
+    Frame& ownFrame() { return enclosing.empty() ? globals : frames[enclosing.back()]; }
+    FunNode* callee(Node* funcExp);
+    void assign(Frame& frame, int slot, Type type);
+
+    void scan(Node* node, bool isCallee);
+    Type infer(Node*& node, bool rewriting);
+};
+
+#endif
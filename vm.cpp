@@ -0,0 +1,740 @@
+#include "vm.h"
+
+#include <iostream>
+#include "heap.h"
+#include "kernels.h"
+#include "memo.h"
+#include "number.h"
+#include "profile.h"
+#include "runtime.h"
+
+// Labels-as-values give each handler its own indirect jump. Cold helpers
+// of the handlers stay out of run(), whose registers they would crowd.
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#define VM_NOINLINE __attribute__((noinline))
+#else
+#define VM_NOINLINE
+#endif
+
+// ---------------------------------------------------------------------------
+// Compiler
+
+// The unchecked instruction for an operator node of the Typer, or HALT
+static VMOp uncheckedOp(BinaryOpNode* op) {
+    if (dynamic_cast<AddIntNode*>(op)) return OP_ADD_INT;
+    if (dynamic_cast<SubIntNode*>(op)) return OP_SUB_INT;
+    if (dynamic_cast<MulIntNode*>(op)) return OP_MUL_INT;
+    if (dynamic_cast<GreaterIntNode*>(op)) return OP_GREATER_INT;
+    if (dynamic_cast<LessIntNode*>(op)) return OP_SMALLER_INT;
+    return OP_HALT;
+}
+
+static VMOp jumpIfFalse(IfNode* ifn) {
+    return dynamic_cast<IfBoolNode*>(ifn) ? OP_JUMP_UNLESS : OP_JUMP_IF_FALSE;
+}
+
+void VM::emitOp(VMOp op, int stackEffect) {
+    code.push_back(op);
+    depth += stackEffect;
+    if (depth > maxDepth) maxDepth = depth;
+}
+
+void VM::compile(const std::vector<Node*>& program) {
+    mainEntry = code.size();
+    emit(0); // Stack size, patched below
+    depth = maxDepth = 0;
+    nesting = 0;
+    for (Node* stmt : program) {
+        compileStmt(stmt);
+    }
+    emitOp(OP_HALT, 0);
+    code[mainEntry] = maxDepth;
+
+    // Calls made under --memoize or --profile return through here
+    hookReturn = code.size();
+    emit(OP_HOOK_RETURN);
+
+    // Function bodies are laid out one after another behind the program
+    while (!pendingFuns.empty()) {
+        FunNode* fun = pendingFuns.back();
+        pendingFuns.pop_back();
+        nesting = fun->globalDepth();
+        if (fun->codeEntry >= 0) continue;
+
+        fun->codeEntry = int(code.size());
+        emit(0);
+        depth = maxDepth = 0;
+        compileTail(fun->body);
+        code[fun->codeEntry] = maxDepth;
+    }
+}
+
+void VM::discardProgram() {
+    code.resize(mainEntry);
+}
+
+void VM::compileStmt(Node* node) {
+    if (auto def = dynamic_cast<DefineNode*>(node)) {
+        compileExpr(def->exp);
+        emitOp(OP_DEFINE, -1);
+        emit(def->slot);
+        emit(def->name);
+    } else if (auto print = dynamic_cast<PrintNode*>(node)) {
+        compileExpr(print->exp);
+        emitOp(print->isNum ? OP_PRINT_NUM : OP_PRINT_BOOL, -1);
+    } else {
+        compileExpr(node);
+        emitOp(OP_POP, -1);
+    }
+}
+
+void VM::compileExpr(Node* node) {
+    if (auto num = dynamic_cast<NumberNode*>(node)) {
+        if (num->val.isFixnum() && num->val.num() == int32_t(num->val.num())) {
+            emitOp(OP_PUSH_NUM, 1);
+            emit(int32_t(num->val.num()));
+        } else {
+            emitOp(OP_PUSH_CONST, 1);
+            emit(int32_t(constants.size()));
+            constants.push_back(num->val);
+        }
+    } else if (auto b = dynamic_cast<BoolNode*>(node)) {
+        emitOp(OP_PUSH_BOOL, 1);
+        emit(b->val ? 1 : 0);
+    } else if (auto var = dynamic_cast<VariableNode*>(node)) {
+        // The outermost frame on the static chain is always the global one
+        if (var->depth == nesting) {
+            emitOp(OP_LOAD_GLOBAL, 1);
+        } else if (var->depth == 0) {
+            emitOp(OP_LOAD_LOCAL, 1);
+        } else {
+            emitOp(OP_LOAD, 1);
+            emit(var->depth);
+        }
+        emit(var->slot);
+        emit(var->name);
+    } else if (auto op = dynamic_cast<BinaryOpNode*>(node)) {
+        VMOp fast = uncheckedOp(op);
+        if (fast != OP_HALT) {
+            for (Node* arg : op->args) compileExpr(arg);
+            int n = int(op->args.size());
+            if (fast == OP_ADD_INT || fast == OP_MUL_INT) {
+                emitOp(fast, 1 - n);
+                emit(n);
+            } else {
+                emitOp(fast, -1);
+            }
+            return;
+        }
+        if (!strictEval && (op->op == OpCode::ADD || op->op == OpCode::MUL ||
+                            op->op == OpCode::EQUAL || op->op == OpCode::AND ||
+                            op->op == OpCode::OR)) {
+            compileVariadic(op);
+            return;
+        }
+        for (Node* arg : op->args) compileExpr(arg);
+        int n = int(op->args.size());
+        switch (op->op) {
+        case OpCode::ADD:     emitOp(OP_ADD, 1 - n); emit(n); break;
+        case OpCode::SUB:     emitOp(OP_SUB, -1); break;
+        case OpCode::MUL:     emitOp(OP_MUL, 1 - n); emit(n); break;
+        case OpCode::DIV:     emitOp(OP_DIV, -1); break;
+        case OpCode::MOD:     emitOp(OP_MOD, -1); break;
+        case OpCode::GREATER: emitOp(OP_GREATER, -1); break;
+        case OpCode::SMALLER: emitOp(OP_SMALLER, -1); break;
+        case OpCode::EQUAL:   emitOp(OP_EQUAL, 1 - n); emit(n); break;
+        case OpCode::AND:     emitOp(OP_AND, 1 - n); emit(n); break;
+        case OpCode::OR:      emitOp(OP_OR, 1 - n); emit(n); break;
+        case OpCode::NOT:     emitOp(OP_NOT, 0); break;
+        }
+    } else if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        compileExpr(ifn->testExp);
+        emitOp(jumpIfFalse(ifn), -1);
+        size_t toElse = code.size();
+        emit(0);
+        compileExpr(ifn->thenExp);
+        emitOp(OP_JUMP, 0);
+        size_t toEnd = code.size();
+        emit(0);
+        depth--; // Only one branch leaves its value
+        code[toElse] = int32_t(code.size());
+        compileExpr(ifn->elseExp);
+        code[toEnd] = int32_t(code.size());
+    } else if (auto fun = dynamic_cast<FunNode*>(node)) {
+        int n = 0;
+        for (size_t i = 0; i < fun->captures.size(); ++i) {
+            if (int(i) == fun->selfCapture) continue;
+            compileExpr(fun->captures[i]);
+            ++n;
+        }
+        funs.push_back(fun);
+        pendingFuns.push_back(fun);
+        emitOp(OP_CLOSURE, 1 - n);
+        emit(int32_t(funs.size() - 1));
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        compileCall(call, false);
+    }
+}
+
+void VM::compileVariadic(BinaryOpNode* op) {
+    std::vector<size_t> exits; // Jumps to patch with the end of the chain
+    size_t n = op->args.size();
+    compileExpr(op->args[0]);
+    switch (op->op) {
+    case OpCode::ADD:
+    case OpCode::MUL:
+        emitOp(OP_CHECK_NUM, 0);
+        for (size_t i = 1; i < n; ++i) {
+            compileExpr(op->args[i]);
+            emitOp(op->op == OpCode::ADD ? OP_ADD_ACC : OP_MUL_ACC, -1);
+        }
+        break;
+    case OpCode::EQUAL:
+        emitOp(OP_CHECK_NUM, 0);
+        for (size_t i = 1; i < n; ++i) {
+            compileExpr(op->args[i]);
+            emitOp(OP_EQUAL_STEP, -1);
+            exits.push_back(code.size());
+            emit(0);
+        }
+        emitOp(OP_EQUAL_TRUE, 0);
+        break;
+    case OpCode::AND:
+    case OpCode::OR:
+        for (size_t i = 1; i < n; ++i) {
+            emitOp(op->op == OpCode::AND ? OP_AND_STEP : OP_OR_STEP, -1);
+            exits.push_back(code.size());
+            emit(0);
+            compileExpr(op->args[i]);
+        }
+        // The last operand is the result once it is a boolean
+        emitOp(OP_CHECK_BOOL, 0);
+        break;
+    default:
+        break;
+    }
+    for (size_t at : exits) code[at] = int32_t(code.size());
+}
+
+void VM::compileTail(Node* node) {
+    if (auto ifn = dynamic_cast<IfNode*>(node)) {
+        compileExpr(ifn->testExp);
+        emitOp(jumpIfFalse(ifn), -1);
+        size_t toElse = code.size();
+        emit(0);
+        int d = depth;
+        compileTail(ifn->thenExp);
+        depth = d;
+        code[toElse] = int32_t(code.size());
+        compileTail(ifn->elseExp);
+    } else if (auto block = dynamic_cast<BlockNode*>(node)) {
+        for (size_t i = 0; i + 1 < block->stmts.size(); ++i) {
+            compileStmt(block->stmts[i]);
+        }
+        compileTail(block->stmts.back());
+    } else if (auto call = dynamic_cast<CallNode*>(node)) {
+        compileCall(call, true);
+    } else {
+        compileExpr(node);
+        emitOp(OP_RETURN, -1);
+    }
+}
+
+void VM::compileCall(CallNode* call, bool tail) {
+    compileExpr(call->funcExp);
+    emitOp(OP_PREPARE, -1);
+    emit(int32_t(call->args.size()));
+    for (size_t i = 0; i < call->args.size(); ++i) {
+        compileExpr(call->args[i]);
+        emitOp(OP_ARG, -1);
+        emit(int32_t(i));
+    }
+    if (tail) {
+        emitOp(profiler.enabled() ? OP_PROFILE_TAILCALL : OP_TAILCALL, 0);
+    } else {
+        emitOp(memoize || profiler.enabled() ? OP_HOOK_CALL : OP_CALL, 1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Machine
+
+namespace {
+
+struct CallInfo {
+    const int32_t* pc;
+    Environment* env;
+    FunNode* fun;
+};
+
+// Calls nest in `calls`, on the heap rather than the C++ stack, so the VM
+// cannot overflow the stack. A recursion fails at about the depth it does
+// in the tree walker all the same (callDepthLimit), or, on a thread
+// without a stack limit, before it takes all the memory there is.
+const size_t MAX_CALL_DEPTH = size_t(1) << 24;
+
+// A frame built by PREPARE whose arguments are still being evaluated
+struct PendingCall {
+    Environment* frame;
+    FunNode* fun;
+};
+
+// A call made by HOOK_CALL, which HOOK_RETURN finishes before going back
+// to `pc`: it caches the result under `key` and ends the profiled activation
+struct HookedCall {
+    bool cached;
+    Memo::Key key;
+    const int32_t* pc;
+};
+
+// ADD, EQUAL, AND and OR of the `n` operands at `args`, each checked in
+// order. Wide lists go through the kernels (kernels.h) first.
+VM_NOINLINE Value addOperands(const Value* args, int n) {
+    Value sum(0);
+    if (sumOperands(args, n, sum)) return sum;
+    for (int i = 0; i < n; ++i) {
+        checkNumber(args[i]);
+        sum = numAdd(sum, args[i]);
+    }
+    return sum;
+}
+
+VM_NOINLINE Value equalOperands(const Value* args, int n) {
+    if (n == 0 || (args[0].isFixnum() && sameOperands(args, n, args[0]))) return Value(true);
+    checkNumber(args[0]);
+    for (int i = 1; i < n; ++i) {
+        checkNumber(args[i]);
+        if (!numEqual(args[i], args[0])) return Value(false);
+    }
+    return Value(true);
+}
+
+VM_NOINLINE Value andOperands(const Value* args, int n) {
+    if (sameOperands(args, n, Value(true))) return Value(true);
+    for (int i = 0; i < n; ++i) {
+        checkBool(args[i]);
+        if (!args[i].boolean()) return Value(false);
+    }
+    return Value(true);
+}
+
+VM_NOINLINE Value orOperands(const Value* args, int n) {
+    if (sameOperands(args, n, Value(false))) return Value(false);
+    for (int i = 0; i < n; ++i) {
+        checkBool(args[i]);
+        if (args[i].boolean()) return Value(true);
+    }
+    return Value(false);
+}
+
+} // namespace
+
+void VM::run(Environment* globals, std::vector<Value>& stack) const {
+    const int32_t* base = code.data();
+    const int32_t* pc = base + mainEntry + 1;
+    Environment* env = globals;
+    FunNode* fun = nullptr; // Function whose frame `env` is; none at top level
+
+    std::vector<CallInfo> calls;
+    size_t maxDepth = callDepthLimit() ? callDepthLimit() : MAX_CALL_DEPTH;
+    std::vector<PendingCall> pending;
+    std::vector<HookedCall> hookedCalls;
+    // Kept across runs, since --stream runs every statement on its own
+    if (stack.empty()) stack.resize(64 * 1024);
+    Value* sp = stack.data();
+
+    // Make room for `need` more operands
+    auto reserve = [&](int32_t need) {
+        if (stack.data() + stack.size() - sp < need) {
+            size_t used = sp - stack.data();
+            stack.resize((used + need) * 2);
+            sp = stack.data() + used;
+        }
+    };
+    reserve(base[mainEntry]);
+
+#ifdef VM_COMPUTED_GOTO
+    static void* const labels[] = {
+#define VM_LABEL(name) &&L_##name,
+        VM_OPCODES(VM_LABEL)
+#undef VM_LABEL
+    };
+#define CASE(name) L_##name:
+#define DISPATCH() goto *labels[*pc++]
+    DISPATCH();
+#else
+#define CASE(name) case OP_##name:
+#define DISPATCH() goto dispatch
+dispatch:
+    switch (*pc++) {
+#endif
+
+    CASE(PUSH_NUM) {
+        *sp++ = Value(int(*pc++));
+        DISPATCH();
+    }
+    CASE(PUSH_CONST) {
+        *sp++ = constants[*pc++];
+        DISPATCH();
+    }
+    CASE(PUSH_BOOL) {
+        *sp++ = Value(*pc++ != 0);
+        DISPATCH();
+    }
+    CASE(LOAD_LOCAL) {
+        const Value& v = env->slots[pc[0]];
+        if (v.isNone()) undefinedError(pc[1]);
+        *sp++ = v;
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(LOAD_GLOBAL) {
+        const Value& v = globals->slots[pc[0]];
+        if (v.isNone()) undefinedError(pc[1]);
+        *sp++ = v;
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(LOAD) {
+        const Value& v = env->ancestor(pc[0])->slots[pc[1]];
+        if (v.isNone()) undefinedError(pc[2]);
+        *sp++ = v;
+        pc += 3;
+        DISPATCH();
+    }
+    CASE(DEFINE) {
+        Value& slot = env->slots[pc[0]];
+        if (!slot.isNone()) redefineError(pc[1]);
+        slot = *--sp;
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(POP) {
+        --sp;
+        DISPATCH();
+    }
+    CASE(ADD) {
+        int n = *pc++;
+        sp -= n;
+        *sp = addOperands(sp, n);
+        ++sp;
+        DISPATCH();
+    }
+    CASE(SUB) {
+        checkNumber(sp[-2]);
+        checkNumber(sp[-1]);
+        sp[-2] = numSub(sp[-2], sp[-1]);
+        --sp;
+        DISPATCH();
+    }
+    CASE(MUL) {
+        int n = *pc++;
+        Value* args = sp - n;
+        Value prod(1);
+        for (int i = 0; i < n; ++i) {
+            checkNumber(args[i]);
+            prod = numMul(prod, args[i]);
+        }
+        sp = args;
+        *sp++ = prod;
+        DISPATCH();
+    }
+    CASE(DIV) {
+        checkNumber(sp[-2]);
+        checkNumber(sp[-1]);
+        if (numIsZero(sp[-1])) divisionByZeroError();
+        sp[-2] = numDiv(sp[-2], sp[-1]);
+        --sp;
+        DISPATCH();
+    }
+    CASE(MOD) {
+        checkNumber(sp[-2]);
+        checkNumber(sp[-1]);
+        if (numIsZero(sp[-1])) divisionByZeroError();
+        sp[-2] = numMod(sp[-2], sp[-1]);
+        --sp;
+        DISPATCH();
+    }
+    CASE(GREATER) {
+        checkNumber(sp[-2]);
+        checkNumber(sp[-1]);
+        sp[-2] = Value(numLess(sp[-1], sp[-2]));
+        --sp;
+        DISPATCH();
+    }
+    CASE(SMALLER) {
+        checkNumber(sp[-2]);
+        checkNumber(sp[-1]);
+        sp[-2] = Value(numLess(sp[-2], sp[-1]));
+        --sp;
+        DISPATCH();
+    }
+    CASE(EQUAL) {
+        int n = *pc++;
+        sp -= n;
+        *sp = equalOperands(sp, n);
+        ++sp;
+        DISPATCH();
+    }
+    CASE(AND) {
+        int n = *pc++;
+        sp -= n;
+        *sp = andOperands(sp, n);
+        ++sp;
+        DISPATCH();
+    }
+    CASE(OR) {
+        int n = *pc++;
+        sp -= n;
+        *sp = orOperands(sp, n);
+        ++sp;
+        DISPATCH();
+    }
+    CASE(NOT) {
+        checkBool(sp[-1]);
+        sp[-1] = Value(!sp[-1].boolean());
+        DISPATCH();
+    }
+    CASE(ADD_INT) {
+        int n = *pc++;
+        Value* args = sp - n;
+        Value sum(0);
+        if (!sumOperands(args, n, sum)) {
+            for (int i = 0; i < n; ++i) sum = numAdd(sum, args[i]);
+        }
+        sp = args;
+        *sp++ = sum;
+        DISPATCH();
+    }
+    CASE(SUB_INT) {
+        sp[-2] = numSub(sp[-2], sp[-1]);
+        --sp;
+        DISPATCH();
+    }
+    CASE(MUL_INT) {
+        int n = *pc++;
+        Value* args = sp - n;
+        Value prod(1);
+        for (int i = 0; i < n; ++i) prod = numMul(prod, args[i]);
+        sp = args;
+        *sp++ = prod;
+        DISPATCH();
+    }
+    CASE(GREATER_INT) {
+        sp[-2] = Value(numLess(sp[-1], sp[-2]));
+        --sp;
+        DISPATCH();
+    }
+    CASE(SMALLER_INT) {
+        sp[-2] = Value(numLess(sp[-2], sp[-1]));
+        --sp;
+        DISPATCH();
+    }
+    CASE(CHECK_NUM) {
+        checkNumber(sp[-1]);
+        DISPATCH();
+    }
+    CASE(CHECK_BOOL) {
+        checkBool(sp[-1]);
+        DISPATCH();
+    }
+    CASE(ADD_ACC) {
+        checkNumber(sp[-1]);
+        sp[-2] = numAdd(sp[-2], sp[-1]);
+        --sp;
+        DISPATCH();
+    }
+    CASE(MUL_ACC) {
+        checkNumber(sp[-1]);
+        sp[-2] = numMul(sp[-2], sp[-1]);
+        --sp;
+        DISPATCH();
+    }
+    CASE(EQUAL_STEP) {
+        checkNumber(sp[-1]);
+        --sp;
+        if (!numEqual(sp[0], sp[-1])) {
+            sp[-1] = Value(false);
+            pc = base + *pc;
+        } else {
+            ++pc;
+        }
+        DISPATCH();
+    }
+    CASE(EQUAL_TRUE) {
+        sp[-1] = Value(true);
+        DISPATCH();
+    }
+    CASE(AND_STEP) {
+        checkBool(sp[-1]);
+        if (!sp[-1].boolean()) {
+            pc = base + *pc;
+        } else {
+            --sp;
+            ++pc;
+        }
+        DISPATCH();
+    }
+    CASE(OR_STEP) {
+        checkBool(sp[-1]);
+        if (sp[-1].boolean()) {
+            pc = base + *pc;
+        } else {
+            --sp;
+            ++pc;
+        }
+        DISPATCH();
+    }
+    CASE(JUMP) {
+        pc = base + *pc;
+        DISPATCH();
+    }
+    CASE(JUMP_IF_FALSE) {
+        const Value& test = *--sp;
+        checkBool(test);
+        pc = test.boolean() ? pc + 1 : base + *pc;
+        DISPATCH();
+    }
+    CASE(JUMP_UNLESS) {
+        pc = (*--sp).boolean() ? pc + 1 : base + *pc;
+        DISPATCH();
+    }
+    CASE(PRINT_NUM) {
+        const Value& v = *--sp;
+        checkNumber(v);
+        printNumber(runtime->out, v);
+        DISPATCH();
+    }
+    CASE(PRINT_BOOL) {
+        const Value& v = *--sp;
+        checkBool(v);
+        runtime->out.printBool(v.boolean());
+        DISPATCH();
+    }
+    CASE(CLOSURE) {
+        FunNode* fun = funs[*pc++];
+        Environment* captured = fun->closureEnv(env);
+        // The captures were pushed in order, leaving out the closure itself
+        int count = int(fun->captures.size());
+        sp -= count - (fun->selfCapture >= 0);
+        for (int i = 0, from = 0; i < count; ++i) {
+            if (i != fun->selfCapture) captured->slots[i] = sp[from++];
+        }
+        FuncData* closure = runtime->heap.newClosure(fun, captured);
+        if (fun->selfCapture >= 0) captured->slots[fun->selfCapture] = Value(closure);
+        *sp++ = Value(closure);
+        DISPATCH();
+    }
+    CASE(PREPARE) {
+        size_t argc = size_t(*pc++);
+        // The callee is still on the stack, so it survives a collection
+        runtime->heap.safePoint(stack.data(), sp);
+        Value func = *--sp;
+        checkFunction(func);
+        FuncData* fData = func.func();
+        FunNode* callee = fData->fun;
+        if (argc != callee->params.size()) arityError(callee->params.size(), argc);
+        Environment* frame = callee->frameEscapes
+            ? runtime->heap.newFrame(fData->env, callee->frameSize)
+            : runtime->frames.push(fData->env, callee->frameSize);
+        runtime->heap.pushRoot(frame);
+        pending.push_back(PendingCall{frame, callee});
+        DISPATCH();
+    }
+    CASE(ARG) {
+        pending.back().frame->slots[*pc++] = *--sp;
+        DISPATCH();
+    }
+    CASE(CALL) {
+        if (calls.size() >= maxDepth) recursionError();
+        PendingCall call = pending.back();
+        pending.pop_back();
+        calls.push_back(CallInfo{pc, env, fun});
+        env = call.frame;
+        fun = call.fun;
+        pc = base + fun->codeEntry;
+        reserve(*pc++);
+        DISPATCH();
+    }
+    CASE(HOOK_CALL) {
+        if (calls.size() >= maxDepth) recursionError();
+        PendingCall call = pending.back();
+        pending.pop_back();
+        HookedCall hooked;
+        size_t argc = call.fun->params.size();
+        hooked.cached = runtime->memo.enabled() &&
+            runtime->memo.makeKey(call.fun, call.frame->parent, call.frame->slots, argc, hooked.key);
+        Value result;
+        if (hooked.cached && runtime->memo.lookup(hooked.key, result)) {
+            runtime->heap.popRoot();
+            if (!call.fun->frameEscapes) {
+                runtime->frames.pop(call.frame);
+            }
+            *sp++ = result;
+            DISPATCH();
+        }
+        if (profiler.enabled()) profiler.enter(call.fun);
+        // RETURN goes to the HOOK_RETURN stub, which then continues at pc
+        hooked.pc = pc;
+        hookedCalls.push_back(hooked);
+        calls.push_back(CallInfo{base + hookReturn, env, fun});
+        env = call.frame;
+        fun = call.fun;
+        pc = base + fun->codeEntry;
+        reserve(*pc++);
+        DISPATCH();
+    }
+    CASE(HOOK_RETURN) {
+        const HookedCall& hooked = hookedCalls.back();
+        if (hooked.cached) runtime->memo.store(hooked.key, sp[-1]);
+        if (profiler.enabled()) profiler.leave();
+        pc = hooked.pc;
+        hookedCalls.pop_back();
+        DISPATCH();
+    }
+    CASE(PROFILE_TAILCALL) {
+        profiler.tailCall(pending.back().fun);
+        goto tail_call;
+    }
+    CASE(TAILCALL) tail_call: {
+        PendingCall call = pending.back();
+        pending.pop_back();
+        runtime->heap.popRoot();
+        if (!fun->frameEscapes) {
+            // Heap frames are left to the collector
+            env = call.fun->frameEscapes ? (runtime->frames.pop(env), call.frame)
+                                         : runtime->frames.replace(env, call.frame);
+        } else {
+            env = call.frame;
+        }
+        runtime->heap.replaceRoot(env);
+        fun = call.fun;
+        pc = base + fun->codeEntry;
+        reserve(*pc++);
+        DISPATCH();
+    }
+    CASE(RETURN) {
+        Value result = *--sp;
+        runtime->heap.popRoot();
+        if (!fun->frameEscapes) {
+            runtime->frames.pop(env);
+        }
+        const CallInfo& caller = calls.back();
+        pc = caller.pc;
+        env = caller.env;
+        fun = caller.fun;
+        calls.pop_back();
+        *sp++ = result;
+        DISPATCH();
+    }
+    CASE(HALT) {
+        return;
+    }
+
+#ifndef VM_COMPUTED_GOTO
+    }
+#endif
+#undef CASE
+#undef DISPATCH
+}
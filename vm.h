@@ -0,0 +1,126 @@
+#ifndef VM_H
+#define VM_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ast.h"
+
+// Opcodes of the bytecode VM. Operands follow the opcode in the code stream.
+#define VM_OPCODES(X)                                                         \
+    X(PUSH_NUM)      /* value                          -> n              */  \
+    X(PUSH_CONST)    /* index, a number beyond 32 bits -> n              */  \
+    X(PUSH_BOOL)     /* 0/1                            -> b              */  \
+    X(LOAD_LOCAL)    /* slot name                      -> v              */  \
+    X(LOAD_GLOBAL)   /* slot name                      -> v              */  \
+    X(LOAD)          /* depth slot name                -> v              */  \
+    X(DEFINE)        /* slot name                    v ->                */  \
+    X(POP)           /*                              v ->                */  \
+    X(ADD)           /* count                     v... -> n              */  \
+    X(SUB)           /*                            a b -> n              */  \
+    X(MUL)           /* count                     v... -> n              */  \
+    X(DIV)           /*                            a b -> n              */  \
+    X(MOD)           /*                            a b -> n              */  \
+    X(GREATER)       /*                            a b -> b              */  \
+    X(SMALLER)       /*                            a b -> b              */  \
+    X(EQUAL)         /* count                     v... -> b              */  \
+    X(AND)           /* count                     v... -> b              */  \
+    X(OR)            /* count                     v... -> b              */  \
+    X(NOT)           /*                              v -> b              */  \
+    X(ADD_INT)       /* count     proven numbers  v... -> n              */  \
+    X(SUB_INT)       /*           proven numbers   a b -> n              */  \
+    X(MUL_INT)       /* count     proven numbers  v... -> n              */  \
+    X(GREATER_INT)   /*           proven numbers   a b -> b              */  \
+    X(SMALLER_INT)   /*           proven numbers   a b -> b              */  \
+    X(CHECK_NUM)     /*                              n -> n              */  \
+    X(CHECK_BOOL)    /*                              b -> b              */  \
+    X(ADD_ACC)       /*                            a n -> a+n            */  \
+    X(MUL_ACC)       /*                            a n -> a*n            */  \
+    X(EQUAL_STEP)    /* target      a n -> a, or #f and jump if a != n   */  \
+    X(EQUAL_TRUE)    /*                              a -> #t             */  \
+    X(AND_STEP)      /* target      b -> , or keep #f and jump           */  \
+    X(OR_STEP)       /* target      b -> , or keep #t and jump           */  \
+    X(JUMP)          /* target                                           */  \
+    X(JUMP_IF_FALSE) /* target                       b ->                */  \
+    X(JUMP_UNLESS)   /* target        proven boolean b ->                */  \
+    X(PRINT_NUM)     /*                              n ->                */  \
+    X(PRINT_BOOL)    /*                              b ->                */  \
+    X(CLOSURE)       /* function              captures... -> f              */  \
+    X(PREPARE)       /* argc                         f -> (frame built)  */  \
+    X(ARG)           /* index                        v -> (into frame)   */  \
+    X(CALL)          /*                                -> result         */  \
+    X(HOOK_CALL)     /* CALL under --memoize or --profile                */  \
+    X(HOOK_RETURN)   /* stub a HOOK_CALL returns to           v -> v     */  \
+    X(TAILCALL)      /* replaces the current frame                       */  \
+    X(PROFILE_TAILCALL) /* TAILCALL under --profile                      */  \
+    X(RETURN)        /*                              v -> (to caller)    */  \
+    X(HALT)
+
+enum VMOp : int32_t {
+#define VM_ENUM(name) OP_##name,
+    VM_OPCODES(VM_ENUM)
+#undef VM_ENUM
+};
+
+// Bytecode compiler and stack machine, an alternative to Node::eval that is
+// selected with --vm. It runs the resolved program (see resolver.h) with
+// the same frames, closures and collector as the tree walker, and reports
+// the same errors in the same order. Variadic operators are compiled into a
+// chain of *_STEP / *_ACC instructions that check and fold each operand as
+// it arrives, or with --strict into a single instruction that checks all
+// operands once they are evaluated. Operators and ifs the Typer (typer.h)
+// proved well typed use *_INT and JUMP_UNLESS, which skip the checks
+// (the short-circuiting ones keep their chains). A call checks its callee and arity
+// before the arguments are evaluated straight into the new frame.
+//
+// Every function body, and the top-level program, starts with one word
+// holding the most operand stack slots it needs, so the stack only has to be
+// checked for room once per call.
+class VM {
+public:
+    // Compile resolved top-level statements; FunNode::codeEntry is filled in.
+    // May be called again for more statements, which then replace the
+    // program that run() executes.
+    void compile(const std::vector<Node*>& program);
+
+    // Compile calls so that the --memoize cache of the runtime sees them.
+    // Set before compile(); --profile is picked up by itself.
+    void memoizeCalls(bool on) { memoize = on; }
+
+    // Run the compiled program against the global frame
+    void run(Environment* globals) { run(globals, operands); }
+
+    // The same with the operand stack of the caller. It does not change the
+    // VM, so several threads may run one compiled program at the same time.
+    void run(Environment* globals, std::vector<Value>& stack) const;
+
+    // Drop the code of the last compiled program. Only valid when it
+    // contained no FunNode, so no function body was compiled behind it.
+    void discardProgram();
+
+private:
+    std::vector<int32_t> code;
+    std::vector<FunNode*> funs;     // CLOSURE operands
+    std::vector<Value> constants;   // PUSH_CONST operands
+    size_t mainEntry = 0;
+    size_t hookReturn = 0; // The HOOK_RETURN stub
+    bool memoize = false;
+    std::vector<Value> operands; // Operand stack of run(globals)
+
+    // Per-body compile state
+    std::vector<FunNode*> pendingFuns;
+    int nesting = 0; // Frames up to the global one
+    int depth = 0;
+    int maxDepth = 0;
+
+    void emit(int32_t word) { code.push_back(word); }
+    void emitOp(VMOp op, int stackEffect);
+    void compileBody(Node* body, bool isFunction);
+    void compileStmt(Node* node);
+    void compileExpr(Node* node);
+    void compileTail(Node* node);
+    void compileCall(CallNode* call, bool tail);
+    void compileVariadic(BinaryOpNode* op);
+};
+
+#endif